@@ -1,5 +1,6 @@
 #pragma once
 #include "NeuralNetwork.h"
+#include "ActivationKernels.h"
 #include <cmath>
 
 // Add Function
@@ -10,6 +11,7 @@ class AddFunction : public ActivationFunction
 public:
 	AddFunction() {
 		name = "basicAdd";
+		kind = ActivationKind::BasicAdd;
 	};
 	~AddFunction() {};
 	double operator()(double in) override {
@@ -28,6 +30,7 @@ public:
 	double threshold = 0;
 	StepFunction() {
 		name = "step";
+		kind = ActivationKind::Step;
 	};
 	~StepFunction() {};
 	double operator()(double in) override {
@@ -45,34 +48,38 @@ private:
 // Sigmoid Function
 // Behavior: The Sigmoid function squashes input values to a range between 0 and 1, making it suitable for binary classification problems.It is smooth and differentiable, making it useful for gradient - based optimization algorithms.
 // Use case: Binary classification problems, output layer of a neural network for probability estimation.
+// Evaluated with the polynomial approximation in ActivationKernels.h, absolute error below 2e-9.
 class SigmoidFunction : public ActivationFunction
 {
 public:
 	SigmoidFunction() {
 		name = "sigmoid";
+		kind = ActivationKind::Sigmoid;
 	}
 
 	~SigmoidFunction() {}
 
 	double operator()(double in) override {
-		return 1.0 / (1.0 + std::exp(-in));
+		return FastSigmoid(in);
 	}
 };
 
 // Hyperbolic Tangent (Tanh) Function
 // Behavior: Similar to the sigmoid function, the Tanh function squashes input values, but it ranges between - 1 and 1. It is often preferred in hidden layers for mitigating the vanishing gradient problem.
 // Use case: Hidden layers of a neural network, especially in recurrent neural networks(RNNs).
+// Evaluated with the polynomial approximation in ActivationKernels.h, absolute error below 4e-9.
 class TanhFunction : public ActivationFunction
 {
 public:
 	TanhFunction() {
 		name = "tanh";
+		kind = ActivationKind::Tanh;
 	}
 
 	~TanhFunction() {}
 
 	double operator()(double in) override {
-		return tanh(in);
+		return FastTanh(in);
 	}
 };
 
@@ -84,6 +91,7 @@ class ReLUFunction : public ActivationFunction
 public:
 	ReLUFunction() {
 		name = "relu";
+		kind = ActivationKind::ReLU;
 	}
 
 	~ReLUFunction() {}
@@ -103,6 +111,7 @@ public:
 
 	LeakyReLUFunction() {
 		name = "leaky_relu";
+		kind = ActivationKind::LeakyReLU;
 	}
 
 	~LeakyReLUFunction() {}
@@ -0,0 +1,236 @@
+#include "ActivationKernels.h"
+#include "ActivationFunctions.h"
+#include "CpuFeatures.h"
+
+// Scalar kernels for both precisions, the compiler is free to vectorize these
+
+template<typename T>
+static void SigmoidSpanScalar(const T* in, T* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		out[i] = FastSigmoid(in[i]);
+	}
+}
+
+template<typename T>
+static void TanhSpanScalar(const T* in, T* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		out[i] = FastTanh(in[i]);
+	}
+}
+
+template<typename T>
+static void StepSpan(T threshold, const T* in, T* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		out[i] = in[i] > threshold ? T(1) : T(0);
+	}
+}
+
+template<typename T>
+static void ReLUSpan(const T* in, T* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		out[i] = std::max(T(0), in[i]);
+	}
+}
+
+template<typename T>
+static void LeakyReLUSpan(T alpha, const T* in, T* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		out[i] = in[i] > 0 ? in[i] : alpha * in[i];
+	}
+}
+
+#ifdef KERNELS_X86
+
+// AVX2 kernels for the exp based functions, compilers will not vectorize the exponent bit tricks on their own
+
+/// <summary>
+/// Four wide version of FastExp
+/// </summary>
+TARGET_AVX2 static inline __m256d FastExpAVX2(__m256d x)
+{
+	const __m256d shifter = _mm256_set1_pd(6755399441055744.0);
+	const __m256d y = _mm256_fmadd_pd(x, _mm256_set1_pd(1.4426950408889634), shifter);
+	const __m256d n = _mm256_sub_pd(y, shifter);
+	const __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(0.6931471805599453), x);
+	__m256d p = _mm256_set1_pd(1.0 / 5040);
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 720));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 120));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 24));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 6));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(0.5));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+	__m256i exponent = _mm256_sub_epi64(_mm256_castpd_si256(y), _mm256_castpd_si256(shifter));
+	exponent = _mm256_slli_epi64(_mm256_add_epi64(exponent, _mm256_set1_epi64x(1023)), 52);
+	return _mm256_mul_pd(p, _mm256_castsi256_pd(exponent));
+}
+
+/// <summary>
+/// Clamps to [-limit, limit], NaN is passed through like the scalar std::min/std::max clamp
+/// </summary>
+TARGET_AVX2 static inline __m256d ClampAVX2(__m256d x, double limit)
+{
+	return _mm256_min_pd(_mm256_set1_pd(limit), _mm256_max_pd(_mm256_set1_pd(-limit), x));
+}
+
+TARGET_AVX2 static void SigmoidSpanAVX2(const double* in, double* out, size_t count)
+{
+	const __m256d one = _mm256_set1_pd(1.0);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m256d x = ClampAVX2(_mm256_loadu_pd(in + i), 40.0);
+		const __m256d e = FastExpAVX2(_mm256_sub_pd(_mm256_setzero_pd(), x));
+		_mm256_storeu_pd(out + i, _mm256_div_pd(one, _mm256_add_pd(one, e)));
+	}
+	SigmoidSpanScalar(in + i, out + i, count - i);
+}
+
+TARGET_AVX2 static void TanhSpanAVX2(const double* in, double* out, size_t count)
+{
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d two = _mm256_set1_pd(2.0);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m256d x = ClampAVX2(_mm256_loadu_pd(in + i), 20.0);
+		const __m256d e = FastExpAVX2(_mm256_mul_pd(_mm256_set1_pd(-2.0), x));
+		_mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_div_pd(two, _mm256_add_pd(one, e)), one));
+	}
+	TanhSpanScalar(in + i, out + i, count - i);
+}
+
+/// <summary>
+/// Eight wide single precision version of FastExp
+/// </summary>
+TARGET_AVX2 static inline __m256 FastExpAVX2(__m256 x)
+{
+	const __m256 shifter = _mm256_set1_ps(12582912.0f);
+	const __m256 y = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504f), shifter);
+	const __m256 n = _mm256_sub_ps(y, shifter);
+	const __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693147181f), x);
+	__m256 p = _mm256_set1_ps(1.0f / 720);
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f / 120));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f / 24));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f / 6));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(0.5f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+	__m256i exponent = _mm256_sub_epi32(_mm256_castps_si256(y), _mm256_castps_si256(shifter));
+	exponent = _mm256_slli_epi32(_mm256_add_epi32(exponent, _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+TARGET_AVX2 static inline __m256 ClampAVX2(__m256 x, float limit)
+{
+	return _mm256_min_ps(_mm256_set1_ps(limit), _mm256_max_ps(_mm256_set1_ps(-limit), x));
+}
+
+TARGET_AVX2 static void SigmoidSpanAVX2(const float* in, float* out, size_t count)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256 x = ClampAVX2(_mm256_loadu_ps(in + i), 40.0f);
+		const __m256 e = FastExpAVX2(_mm256_sub_ps(_mm256_setzero_ps(), x));
+		_mm256_storeu_ps(out + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+	}
+	SigmoidSpanScalar(in + i, out + i, count - i);
+}
+
+TARGET_AVX2 static void TanhSpanAVX2(const float* in, float* out, size_t count)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256 x = ClampAVX2(_mm256_loadu_ps(in + i), 20.0f);
+		const __m256 e = FastExpAVX2(_mm256_mul_ps(_mm256_set1_ps(-2.0f), x));
+		_mm256_storeu_ps(out + i, _mm256_sub_ps(_mm256_div_ps(two, _mm256_add_ps(one, e)), one));
+	}
+	TanhSpanScalar(in + i, out + i, count - i);
+}
+
+#endif
+
+template<typename T>
+static void SigmoidSpan(const T* in, T* out, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetKernelLevel() == KernelLevel::AVX2)
+	{
+		return SigmoidSpanAVX2(in, out, count);
+	}
+#endif
+	SigmoidSpanScalar(in, out, count);
+}
+
+template<typename T>
+static void TanhSpan(const T* in, T* out, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetKernelLevel() == KernelLevel::AVX2)
+	{
+		return TanhSpanAVX2(in, out, count);
+	}
+#endif
+	TanhSpanScalar(in, out, count);
+}
+
+template<typename T>
+static void ApplyActivationSpan(ActivationFunction& function, const T* in, T* out, size_t count)
+{
+	switch (function.kind)
+	{
+	case ActivationKind::BasicAdd:
+		if (in != out)
+		{
+			std::copy(in, in + count, out);
+		}
+		break;
+	case ActivationKind::Step:
+		StepSpan(static_cast<T>(static_cast<StepFunction&>(function).threshold), in, out, count);
+		break;
+	case ActivationKind::Sigmoid:
+		SigmoidSpan(in, out, count);
+		break;
+	case ActivationKind::Tanh:
+		TanhSpan(in, out, count);
+		break;
+	case ActivationKind::ReLU:
+		ReLUSpan(in, out, count);
+		break;
+	case ActivationKind::LeakyReLU:
+		LeakyReLUSpan(static_cast<T>(static_cast<LeakyReLUFunction&>(function).alpha), in, out, count);
+		break;
+	default:
+		// Slow path for user defined functions
+		for (size_t i = 0; i < count; i++)
+		{
+			out[i] = static_cast<T>(function(in[i]));
+		}
+		break;
+	}
+}
+
+void ApplyActivation(ActivationFunction& function, const double* in, double* out, size_t count)
+{
+	ApplyActivationSpan(function, in, out, count);
+}
+
+void ApplyActivation(ActivationFunction& function, const float* in, float* out, size_t count)
+{
+	ApplyActivationSpan(function, in, out, count);
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <bit>
+#include <algorithm>
+
+class ActivationFunction;
+
+// Span kernels for the built in activation functions, selected by ActivationFunction::kind.
+//
+// Sigmoid and tanh use a polynomial exp: the input is split as x = n * ln2 + r with |r| <= ln2 / 2,
+// exp(r) is the degree 7 Taylor polynomial and 2^n is built directly in the exponent bits.
+// The relative error of FastExp is below 6e-9, which bounds the absolute error of FastSigmoid
+// below 2e-9 and of FastTanh below 4e-9 over the whole real line.
+// The float overloads use a degree 6 polynomial and are accurate to a few float ulps, the absolute
+// error of the float sigmoid and tanh is below 5e-7.
+
+/// <summary>
+/// Polynomial approximation of exp, valid for |x| <= 700
+/// </summary>
+inline double FastExp(double x)
+{
+	const double shifter = 6755399441055744.0; // 1.5 * 2^52, adding it rounds to an integer held in the low mantissa bits
+	const double y = x * 1.4426950408889634 + shifter;
+	const double n = y - shifter;
+	const double r = x - n * 0.6931471805599453;
+	double p = 1.0 / 5040;
+	p = p * r + 1.0 / 720;
+	p = p * r + 1.0 / 120;
+	p = p * r + 1.0 / 24;
+	p = p * r + 1.0 / 6;
+	p = p * r + 0.5;
+	p = p * r + 1.0;
+	p = p * r + 1.0;
+	const int64_t exponent = std::bit_cast<int64_t>(y) - std::bit_cast<int64_t>(shifter) + 1023;
+	return p * std::bit_cast<double>(exponent << 52);
+}
+
+/// <summary>
+/// Fast sigmoid, absolute error below 2e-9
+/// </summary>
+inline double FastSigmoid(double x)
+{
+	// Beyond +-40 the sigmoid is within 5e-18 of 0 or 1
+	x = std::min(std::max(x, -40.0), 40.0);
+	return 1.0 / (1.0 + FastExp(-x));
+}
+
+/// <summary>
+/// Fast tanh, absolute error below 4e-9
+/// </summary>
+inline double FastTanh(double x)
+{
+	x = std::min(std::max(x, -20.0), 20.0);
+	return 2.0 / (1.0 + FastExp(-2.0 * x)) - 1.0;
+}
+
+/// <summary>
+/// Single precision polynomial approximation of exp, valid for |x| <= 80
+/// </summary>
+inline float FastExp(float x)
+{
+	const float shifter = 12582912.0f; // 1.5 * 2^23, adding it rounds to an integer held in the low mantissa bits
+	const float y = x * 1.44269504f + shifter;
+	const float n = y - shifter;
+	const float r = x - n * 0.693147181f;
+	float p = 1.0f / 720;
+	p = p * r + 1.0f / 120;
+	p = p * r + 1.0f / 24;
+	p = p * r + 1.0f / 6;
+	p = p * r + 0.5f;
+	p = p * r + 1.0f;
+	p = p * r + 1.0f;
+	const int32_t exponent = std::bit_cast<int32_t>(y) - std::bit_cast<int32_t>(shifter) + 127;
+	return p * std::bit_cast<float>(exponent << 23);
+}
+
+/// <summary>
+/// Single precision fast sigmoid, absolute error below 5e-7
+/// </summary>
+inline float FastSigmoid(float x)
+{
+	x = std::min(std::max(x, -40.0f), 40.0f);
+	return 1.0f / (1.0f + FastExp(-x));
+}
+
+/// <summary>
+/// Single precision fast tanh, absolute error below 5e-7
+/// </summary>
+inline float FastTanh(float x)
+{
+	x = std::min(std::max(x, -20.0f), 20.0f);
+	return 2.0f / (1.0f + FastExp(-2.0f * x)) - 1.0f;
+}
+
+/// <summary>
+/// Applies an activation function to a span of values
+/// </summary>
+/// <param name="function"> activation function, built in functions use their span kernel and custom ones are called once per value</param>
+/// <param name="in"> summed inputs of the nodes</param>
+/// <param name="out"> activated values, may be the same buffer as in</param>
+/// <param name="count"> number of values</param>
+void ApplyActivation(ActivationFunction& function, const double* in, double* out, size_t count);
+
+/// <summary>
+/// Single precision version of ApplyActivation, custom functions are evaluated in double precision
+/// </summary>
+void ApplyActivation(ActivationFunction& function, const float* in, float* out, size_t count);
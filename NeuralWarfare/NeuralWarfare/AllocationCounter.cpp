@@ -0,0 +1,74 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+static thread_local size_t threadAllocationCount = 0;
+
+size_t GetThreadAllocationCount()
+{
+	return threadAllocationCount;
+}
+
+void SetThreadAllocationCount(size_t count)
+{
+	threadAllocationCount = count;
+}
+
+// Replacements for the global allocation functions. The array and nothrow forms are replaced too,
+// so every form pairs with a matching delete even on runtimes that do not forward them to the plain form.
+
+void* operator new(size_t size)
+{
+	threadAllocationCount++;
+	if (void* ptr = std::malloc(size ? size : 1))
+	{
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	threadAllocationCount++;
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
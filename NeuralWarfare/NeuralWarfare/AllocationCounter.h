@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+
+// Counts heap allocations made through the global operator new (every form except the aligned ones).
+// The count is kept per thread so a step running beside the engine update only sees its own allocations.
+// ThreadPool charges the allocations of its tasks to the thread that started them, so a thread's count
+// includes the work it split over the pool.
+
+/// <summary>
+/// Gets the number of heap allocations made by the calling thread since it started
+/// </summary>
+size_t GetThreadAllocationCount();
+
+/// <summary>
+/// Sets the allocation count of the calling thread, lets the thread pool move the allocations of a task to the thread that started it
+/// </summary>
+void SetThreadAllocationCount(size_t count);
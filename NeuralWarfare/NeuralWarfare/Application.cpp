@@ -1,9 +1,17 @@
 #include "Application.h"
 #include "MainMenuState.h"
 #include <chrono>
+#include "RandomStream.h"
 #include "TrainingState.h"
 #include "TestSelectionState.h";
 #include "TestingState.h"
+Application::Application(Config& config) : config(config)
+{
+    seed = ResolveRunSeed(config.app.seed);
+    // Logged so a run can be repeated by putting the seed in the config
+    std::cerr << "INFO: Run seed " << seed << std::endl;
+}
+
 void Application::Run()
 {
     InitWindow(config.app.screenWidth, config.app.screenHeight, "NeuralWarfare");
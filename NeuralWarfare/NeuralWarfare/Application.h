@@ -2,7 +2,7 @@
 #include "GameState.h"
 #include "raylib.h"
 #include "Configs.h"
-#include <random>
+#include <cstdint>
 
 /// <summary>
 /// Application class to handle gamestates and the main loop 
@@ -15,7 +15,7 @@ public:
 	/// Application constructor
 	/// </summary>
 	/// <param name="config">Config class that has been loaded with the session configs</param>
-	Application(Config& config ) : config(config), gen(std::random_device()()){};
+	Application(Config& config );
 	~Application() {};
 
 	/// <summary>
@@ -35,7 +35,7 @@ public:
 	void Quit() { shouldExit = true; }
 
 	Config& config;
-	std::mt19937 gen;
+	uint64_t seed; // Seed of the run, every random stream is derived from it
 	GameState* currentGameState = nullptr;
 protected:
 private:
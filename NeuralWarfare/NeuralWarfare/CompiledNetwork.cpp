@@ -0,0 +1,449 @@
+#include "CompiledNetwork.h"
+#include "NeuralNetwork.h"
+#include "DenseKernels.h"
+#include "ActivationKernels.h"
+#include <algorithm>
+#include <atomic>
+
+/// <summary>
+/// Folds an array into a FNV-1a hash
+/// </summary>
+template<typename T>
+static void HashArray(uint64_t& hash, const std::vector<T>& array)
+{
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(array.data());
+	for (size_t i = 0; i < array.size() * sizeof(T); i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	hash ^= array.size();
+	hash *= 1099511628211ull;
+}
+
+static std::atomic<uint64_t> nextPlanId = 0; // Id handed to the next compiled, forked or patched plan.
+
+/// <summary>
+/// Finds the block containing an index
+/// </summary>
+/// <param name="blockStart"> first index of each block, with one extra entry holding the index count</param>
+static size_t FindBlock(const std::vector<uint32_t>& blockStart, uint32_t index)
+{
+	return std::upper_bound(blockStart.begin(), blockStart.end() - 1, index) - blockStart.begin() - 1;
+}
+
+size_t PlanTopology::LayerOf(uint32_t node) const
+{
+	return FindBlock(layerStart, node);
+}
+
+CompiledNetwork::CompiledNetwork(const NeuralNetwork& network)
+{
+	id = nextPlanId++;
+	std::shared_ptr<PlanTopology> layout = std::make_shared<PlanTopology>();
+	PlanTopology& t = *layout;
+
+	// Number the nodes in layer order and build the activation table
+	std::vector<double> bias;
+	std::vector<double> synapseWeight;
+	uint32_t nodeIndex = 0;
+	for (const Layer* layer : network)
+	{
+		t.layerStart.push_back(nodeIndex);
+		for (Node* node : *layer)
+		{
+			node->planIndex = nodeIndex++;
+
+			uint16_t id = 0;
+			while (id < t.activations.size() && t.activations[id] != node->function)
+			{
+				id++;
+			}
+			if (id == t.activations.size())
+			{
+				t.activations.push_back(node->function);
+			}
+			t.activationId.push_back(id);
+			bias.push_back(node->bias);
+		}
+	}
+	t.layerStart.push_back(nodeIndex);
+	const size_t layerCount = t.layerStart.size() - 1;
+
+	// Gather the incoming synapses of every node, sorted by source so they are summed in the same order the graph propagates them
+	std::vector<std::pair<uint32_t, Synapse*>> incoming;
+	t.synapseStart.reserve(nodeIndex + 1);
+	for (const Layer* layer : network)
+	{
+		t.layerSynapseStart.push_back(static_cast<uint32_t>(t.synapseSource.size()));
+		for (Node* node : *layer)
+		{
+			t.synapseStart.push_back(static_cast<uint32_t>(t.synapseSource.size()));
+			incoming.clear();
+			for (Synapse* synapse : node->inputs)
+			{
+				incoming.emplace_back(synapse->in->planIndex, synapse);
+			}
+			std::stable_sort(incoming.begin(), incoming.end(),
+				[](const std::pair<uint32_t, Synapse*>& a, const std::pair<uint32_t, Synapse*>& b) { return a.first < b.first; });
+			for (const std::pair<uint32_t, Synapse*>& synapse : incoming)
+			{
+				synapse.second->planIndex = static_cast<uint32_t>(t.synapseSource.size());
+				t.synapseSource.push_back(synapse.first);
+				synapseWeight.push_back(synapse.second->weight);
+			}
+		}
+	}
+	t.synapseStart.push_back(static_cast<uint32_t>(t.synapseSource.size()));
+	t.layerSynapseStart.push_back(static_cast<uint32_t>(t.synapseSource.size()));
+
+	// Find fully connected layers, with sorted sources their incoming weights are already a row major matrix
+	t.denseLayer.assign(layerCount, 0);
+	for (size_t l = 1; l < layerCount; l++)
+	{
+		const uint32_t columnStart = t.layerStart[l - 1];
+		const uint32_t columns = t.layerStart[l] - columnStart;
+		bool dense = columns > 0 && t.layerStart[l + 1] > t.layerStart[l];
+		for (uint32_t n = t.layerStart[l]; dense && n < t.layerStart[l + 1]; n++)
+		{
+			dense = t.synapseStart[n + 1] - t.synapseStart[n] == columns;
+			for (uint32_t c = 0; dense && c < columns; c++)
+			{
+				dense = t.synapseSource[t.synapseStart[n] + c] == columnStart + c;
+			}
+		}
+		t.denseLayer[l] = dense;
+	}
+
+	// Split each layer into runs of nodes sharing an activation function so they are applied as one span
+	for (size_t l = 0; l < layerCount; l++)
+	{
+		t.layerRunStart.push_back(static_cast<uint32_t>(t.activationRunStart.size()));
+		for (uint32_t n = t.layerStart[l]; n < t.layerStart[l + 1]; n++)
+		{
+			if (n == t.layerStart[l] || t.activationId[n] != t.activationId[n - 1])
+			{
+				t.activationRunStart.push_back(n);
+			}
+		}
+	}
+	t.layerRunStart.push_back(static_cast<uint32_t>(t.activationRunStart.size()));
+	t.activationRunStart.push_back(nodeIndex);
+
+	for (const Node* node : network.inputNodes)
+	{
+		t.inputIndex.push_back(node->planIndex);
+	}
+	for (const Node* node : network.outputNodes)
+	{
+		t.outputIndex.push_back(node->planIndex);
+	}
+
+	// Store the parameters in the network's precision, one block per layer
+	precision = network.GetPrecision();
+	if (precision == Precision::Float32)
+	{
+		float32.bias.Assign(bias, t.layerStart);
+		float32.synapseWeight.Assign(synapseWeight, t.layerSynapseStart);
+		float32.values.assign(nodeIndex, 0);
+		float32.preActivation.resize(nodeIndex);
+	}
+	else
+	{
+		float64.bias.Assign(bias, t.layerStart);
+		float64.synapseWeight.Assign(synapseWeight, t.layerSynapseStart);
+		float64.values.assign(nodeIndex, 0);
+		float64.preActivation.resize(nodeIndex);
+	}
+
+	topologyHash = 14695981039346656037ull;
+	HashArray(topologyHash, t.activations);
+	HashArray(topologyHash, t.activationId);
+	HashArray(topologyHash, t.layerStart);
+	HashArray(topologyHash, t.synapseStart);
+	HashArray(topologyHash, t.synapseSource);
+	HashArray(topologyHash, t.inputIndex);
+	HashArray(topologyHash, t.outputIndex);
+	topologyHash ^= static_cast<uint8_t>(precision);
+	topologyHash *= 1099511628211ull;
+
+	topology = std::move(layout);
+}
+
+CompiledNetwork::CompiledNetwork(const CompiledNetwork& other) :
+	precision(other.precision),
+	id(nextPlanId++),
+	topologyHash(other.topologyHash),
+	topology(other.topology)
+{
+	// The topology and parameter blocks are shared, the node values and scratch buffers are per plan
+	float64.bias = other.float64.bias;
+	float64.synapseWeight = other.float64.synapseWeight;
+	float32.bias = other.float32.bias;
+	float32.synapseWeight = other.float32.synapseWeight;
+	if (precision == Precision::Float32)
+	{
+		float32.values.assign(NodeCount(), 0);
+		float32.preActivation.resize(NodeCount());
+	}
+	else
+	{
+		float64.values.assign(NodeCount(), 0);
+		float64.preActivation.resize(NodeCount());
+	}
+}
+
+void CompiledNetwork::SetBias(uint32_t node, double bias)
+{
+	if (precision == Precision::Float32)
+	{
+		SetParameter(float32.bias, topology->layerStart, node, bias);
+	}
+	else
+	{
+		SetParameter(float64.bias, topology->layerStart, node, bias);
+	}
+}
+
+void CompiledNetwork::SetWeight(uint32_t synapse, double weight)
+{
+	if (precision == Precision::Float32)
+	{
+		SetParameter(float32.synapseWeight, topology->layerSynapseStart, synapse, weight);
+	}
+	else
+	{
+		SetParameter(float64.synapseWeight, topology->layerSynapseStart, synapse, weight);
+	}
+}
+
+template<typename T>
+void CompiledNetwork::SetParameter(LayerBlocks<T>& blocks, const std::vector<uint32_t>& blockStart, uint32_t index, double value)
+{
+	const size_t block = FindBlock(blockStart, index);
+	blocks.MutableBlock(block)[index - blockStart[block]] = static_cast<T>(value);
+
+	// Population evaluators repack their groups when a member's id changes
+	id = nextPlanId++;
+}
+
+bool CompiledNetwork::SameTopology(const CompiledNetwork& other) const
+{
+	if (topology == other.topology)
+	{
+		return precision == other.precision;
+	}
+	const PlanTopology& a = *topology;
+	const PlanTopology& b = *other.topology;
+	return topologyHash == other.topologyHash &&
+		precision == other.precision &&
+		a.activations == b.activations &&
+		a.activationId == b.activationId &&
+		a.layerStart == b.layerStart &&
+		a.synapseStart == b.synapseStart &&
+		a.synapseSource == b.synapseSource &&
+		a.inputIndex == b.inputIndex &&
+		a.outputIndex == b.outputIndex;
+}
+
+void CompiledNetwork::Evaluate(const double* inputs, size_t inputCount, double* outputs, size_t outputCount)
+{
+	if (precision == Precision::Float32)
+	{
+		EvaluateAs<float>(inputs, inputCount, outputs, outputCount);
+	}
+	else
+	{
+		EvaluateAs<double>(inputs, inputCount, outputs, outputCount);
+	}
+}
+
+void CompiledNetwork::Evaluate(const float* inputs, size_t inputCount, float* outputs, size_t outputCount)
+{
+	if (precision == Precision::Float32)
+	{
+		EvaluateAs<float>(inputs, inputCount, outputs, outputCount);
+	}
+	else
+	{
+		EvaluateAs<double>(inputs, inputCount, outputs, outputCount);
+	}
+}
+
+template<typename T, typename In, typename Out>
+void CompiledNetwork::EvaluateAs(const In* inputs, size_t inputCount, Out* outputs, size_t outputCount)
+{
+	const PlanTopology& t = *topology;
+	PlanParameters<T>& parameters = Parameters<T>();
+	FillBias(parameters.preActivation.data(), 1);
+
+	for (size_t i = 0; i < inputCount && i < t.inputIndex.size(); i++)
+	{
+		parameters.preActivation[t.inputIndex[i]] += static_cast<T>(inputs[i]);
+	}
+
+	Propagate(parameters.synapseWeight, parameters.preActivation.data(), parameters.values.data(), 1);
+
+	for (size_t i = 0; i < outputCount && i < t.outputIndex.size(); i++)
+	{
+		outputs[i] = static_cast<Out>(parameters.values[t.outputIndex[i]]);
+	}
+}
+
+void CompiledNetwork::EvaluateBatch(const double* inputs, size_t inputStride, double* outputs, size_t outputStride, size_t batch)
+{
+	if (precision == Precision::Float32)
+	{
+		EvaluateBatchAs<float>(inputs, inputStride, outputs, outputStride, batch);
+	}
+	else
+	{
+		EvaluateBatchAs<double>(inputs, inputStride, outputs, outputStride, batch);
+	}
+}
+
+template<typename T>
+void CompiledNetwork::EvaluateBatchAs(const double* inputs, size_t inputStride, double* outputs, size_t outputStride, size_t batch)
+{
+	const PlanTopology& t = *topology;
+	PlanParameters<T>& parameters = Parameters<T>();
+	const size_t nodeCount = NodeCount();
+	parameters.batchPreActivation.resize(nodeCount * batch);
+	parameters.batchValues.resize(nodeCount * batch);
+
+	FillBias(parameters.batchPreActivation.data(), batch);
+	for (size_t n = 0; n < nodeCount; n++)
+	{
+		std::fill_n(&parameters.batchValues[n * batch], batch, parameters.values[n]);
+	}
+
+	const size_t inputCount = std::min(inputStride, t.inputIndex.size());
+	for (size_t i = 0; i < inputCount; i++)
+	{
+		T* nodePre = &parameters.batchPreActivation[t.inputIndex[i] * batch];
+		for (size_t b = 0; b < batch; b++)
+		{
+			nodePre[b] += static_cast<T>(inputs[b * inputStride + i]);
+		}
+	}
+
+	Propagate(parameters.synapseWeight, parameters.batchPreActivation.data(), parameters.batchValues.data(), batch);
+
+	const size_t outputCount = std::min(outputStride, t.outputIndex.size());
+	for (size_t b = 0; b < batch; b++)
+	{
+		for (size_t o = 0; o < outputCount; o++)
+		{
+			outputs[b * outputStride + o] = parameters.batchValues[t.outputIndex[o] * batch + b];
+		}
+	}
+}
+
+template<typename T>
+void CompiledNetwork::FillBias(T* preActivation, size_t batch) const
+{
+	const PlanTopology& t = *topology;
+	const LayerBlocks<T>& bias = Parameters<T>().bias;
+	for (size_t l = 0; l < bias.BlockCount(); l++)
+	{
+		const T* layerBias = bias.Block(l);
+		const uint32_t begin = t.layerStart[l];
+		if (batch == 1)
+		{
+			std::copy(layerBias, layerBias + (t.layerStart[l + 1] - begin), preActivation + begin);
+			continue;
+		}
+		for (uint32_t n = begin; n < t.layerStart[l + 1]; n++)
+		{
+			std::fill_n(preActivation + n * batch, batch, layerBias[n - begin]);
+		}
+	}
+}
+
+void CompiledNetwork::EvaluateInterleaved(double* preActivation, double* values, size_t batch) const
+{
+	Propagate(float64.synapseWeight, preActivation, values, batch);
+}
+
+void CompiledNetwork::EvaluateInterleaved(float* preActivation, float* values, size_t batch) const
+{
+	Propagate(float32.synapseWeight, preActivation, values, batch);
+}
+
+template<typename T>
+void CompiledNetwork::Propagate(const LayerBlocks<T>& weights, T* preActivation, T* values, size_t batch) const
+{
+	const PlanTopology& t = *topology;
+
+	// Sources are always in an earlier layer, except for synapses pointing backwards which read the value from the last evaluation
+	for (size_t l = 0; l + 1 < t.layerStart.size(); l++)
+	{
+		const uint32_t begin = t.layerStart[l];
+		const uint32_t end = t.layerStart[l + 1];
+		const T* layerWeights = weights.Block(l); // Indexed by synapse - firstSynapse
+		const uint32_t firstSynapse = t.layerSynapseStart[l];
+		if (t.denseLayer[l])
+		{
+			const uint32_t columnStart = t.layerStart[l - 1];
+			if (batch == 1)
+			{
+				DenseMatVec(layerWeights, end - begin, begin - columnStart, values + columnStart, preActivation + begin);
+			}
+			else
+			{
+				DenseMatMat(layerWeights, end - begin, begin - columnStart,
+					values + columnStart * batch, batch, preActivation + begin * batch, batch, batch);
+			}
+		}
+		else if (batch == 1)
+		{
+			for (uint32_t n = begin; n < end; n++)
+			{
+				T sum = preActivation[n];
+				for (uint32_t s = t.synapseStart[n]; s < t.synapseStart[n + 1]; s++)
+				{
+					sum += values[t.synapseSource[s]] * layerWeights[s - firstSynapse];
+				}
+				preActivation[n] = sum;
+			}
+		}
+		else
+		{
+			for (uint32_t n = begin; n < end; n++)
+			{
+				for (uint32_t s = t.synapseStart[n]; s < t.synapseStart[n + 1]; s++)
+				{
+					VectorScaleAdd(layerWeights[s - firstSynapse], values + t.synapseSource[s] * batch, preActivation + n * batch, batch);
+				}
+			}
+		}
+		ActivateLayerAs(l, preActivation, values, batch);
+	}
+}
+
+void CompiledNetwork::ActivateLayer(size_t layer, const double* preActivation, double* values, size_t batch) const
+{
+	ActivateLayerAs(layer, preActivation, values, batch);
+}
+
+void CompiledNetwork::ActivateLayer(size_t layer, const float* preActivation, float* values, size_t batch) const
+{
+	ActivateLayerAs(layer, preActivation, values, batch);
+}
+
+template<typename T>
+void CompiledNetwork::ActivateLayerAs(size_t layer, const T* preActivation, T* values, size_t batch) const
+{
+	const PlanTopology& t = *topology;
+	for (uint32_t r = t.layerRunStart[layer]; r < t.layerRunStart[layer + 1]; r++)
+	{
+		const uint32_t begin = t.activationRunStart[r];
+		const uint32_t end = t.activationRunStart[r + 1];
+		ApplyActivation(*t.activations[t.activationId[begin]], preActivation + begin * batch, values + begin * batch, (end - begin) * batch);
+	}
+}
+
+double CompiledNetwork::Value(size_t node) const
+{
+	return precision == Precision::Float32 ? float32.values[node] : float64.values[node];
+}
@@ -0,0 +1,296 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+class ActivationFunction;
+class NeuralNetwork;
+enum class Precision : uint8_t;
+
+/// <summary>
+/// Array split into one block per layer, plans forked from each other share their blocks until one of them writes to a block.
+/// </summary>
+template<typename T>
+class LayerBlocks
+{
+public:
+	/// <summary>
+	/// Splits an array into blocks.
+	/// </summary>
+	/// <param name="values">The array.</param>
+	/// <param name="blockStart">Index of the first value of each block, with one extra entry holding the size of the array.</param>
+	template<typename U>
+	void Assign(const std::vector<U>& values, const std::vector<uint32_t>& blockStart)
+	{
+		blocks.clear();
+		for (size_t b = 0; b + 1 < blockStart.size(); b++)
+		{
+			blocks.push_back(std::make_shared<std::vector<T>>(values.begin() + blockStart[b], values.begin() + blockStart[b + 1]));
+		}
+	}
+
+	size_t BlockCount() const { return blocks.size(); }
+
+	/// <summary>
+	/// Gets a block for reading.
+	/// </summary>
+	const T* Block(size_t block) const { return blocks[block]->data(); }
+
+	/// <summary>
+	/// Gets a block for writing, copying it first if it is shared with another plan.
+	/// </summary>
+	T* MutableBlock(size_t block)
+	{
+		if (blocks[block].use_count() > 1)
+		{
+			blocks[block] = std::make_shared<std::vector<T>>(*blocks[block]);
+		}
+		return blocks[block]->data();
+	}
+
+	/// <summary>
+	/// Checks whether both arrays hold the same values, shared blocks are not compared value by value.
+	/// </summary>
+	bool operator==(const LayerBlocks& other) const
+	{
+		if (blocks.size() != other.blocks.size())
+		{
+			return false;
+		}
+		for (size_t b = 0; b < blocks.size(); b++)
+		{
+			if (blocks[b] != other.blocks[b] && *blocks[b] != *other.blocks[b])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	bool operator!=(const LayerBlocks& other) const { return !(*this == other); }
+
+private:
+	std::vector<std::shared_ptr<std::vector<T>>> blocks; // Values of each block.
+};
+
+/// <summary>
+/// Bias, weight and node value arrays of a plan in one precision.
+/// </summary>
+/// <remarks>
+/// The bias block of a layer holds the biases of its nodes, the weight block of a layer holds the incoming synapses of its nodes.
+/// The value and scratch arrays belong to one plan and are indexed by node.
+/// </remarks>
+template<typename T>
+struct PlanParameters
+{
+	LayerBlocks<T> bias; // Bias of each node, one block per layer.
+	LayerBlocks<T> synapseWeight; // Weight of each incoming synapse, one block per layer.
+	std::vector<T> values; // Output value of each node from the last evaluation.
+	std::vector<T> preActivation; // Scratch buffer holding the summed input of each node.
+	std::vector<T> batchPreActivation; // Scratch buffer for EvaluateBatch, interleaved as [node][entry].
+	std::vector<T> batchValues; // Scratch buffer for EvaluateBatch, interleaved as [node][entry].
+};
+
+/// <summary>
+/// Node and synapse layout of a plan, it never changes after compiling and is shared by every plan forked from it.
+/// </summary>
+struct PlanTopology
+{
+	std::vector<ActivationFunction*> activations; // Table of activation functions used by the plan, indexed by activationId.
+
+	std::vector<uint16_t> activationId; // Index into activations for each node.
+
+	std::vector<uint32_t> layerStart; // First node of each layer, with one extra entry holding the node count.
+	std::vector<uint32_t> activationRunStart; // First node of each run of nodes within a layer sharing an activation, with one extra entry holding the node count.
+	std::vector<uint32_t> layerRunStart; // First activation run of each layer, with one extra entry holding the run count.
+
+	std::vector<uint32_t> synapseStart; // First incoming synapse of each node, with one extra entry holding the synapse count.
+	std::vector<uint32_t> synapseSource; // Index of the node each incoming synapse reads from.
+	std::vector<uint32_t> layerSynapseStart; // First incoming synapse of each layer, with one extra entry holding the synapse count.
+
+	std::vector<uint8_t> denseLayer; // 1 for each layer whose nodes read exactly every node of the previous layer, their weights form a row major matrix.
+
+	std::vector<uint32_t> inputIndex; // Node index of each network input.
+	std::vector<uint32_t> outputIndex; // Node index of each network output.
+
+	/// <summary>
+	/// Gets the layer containing a node.
+	/// </summary>
+	size_t LayerOf(uint32_t node) const;
+};
+
+/// <summary>
+/// Flat, contiguous inference plan lowered from a NeuralNetwork's layer/node/synapse graph.
+/// </summary>
+/// <remarks>
+/// Nodes are stored in topological (layer) order. Each node pulls its inputs through a CSR style
+/// synapse table, so evaluating the plan is a linear sweep over a few arrays instead of a walk
+/// through the linked lists of the graph. Each layer is summed before it is activated, so a synapse
+/// reading from a node in the same layer or a later one sees the value from the last evaluation.
+/// The plan is owned by its network and thrown away whenever the graph's structure changes, it is rebuilt
+/// the next time the network is evaluated. Bias and weight changes are patched into the plan instead.
+///
+/// The topology and the per layer parameter blocks are shared copy-on-write: a copied network forks
+/// its parent's plan, and a mutation only copies the blocks of the layers it touches.
+///
+/// The parameters are held in the precision of the network, a single precision plan only fills the
+/// float32 arrays and runs on the float kernels with twice the SIMD width. Inputs and outputs of
+/// either precision are converted as needed.
+/// </remarks>
+class CompiledNetwork
+{
+public:
+	/// <summary>
+	/// Compiles a neural network into a flat plan.
+	/// </summary>
+	/// <param name="network">The neural network to compile.</param>
+	CompiledNetwork(const NeuralNetwork& network);
+
+	/// <summary>
+	/// Forks a plan, the copy shares the topology and parameter blocks of the original and gets its own node values.
+	/// </summary>
+	/// <param name="other">The plan to fork.</param>
+	CompiledNetwork(const CompiledNetwork& other);
+
+	/// <summary>
+	/// CompiledNetwork destructor.
+	/// </summary>
+	~CompiledNetwork() {};
+
+	/// <summary>
+	/// Sets the bias of a node, copying its layer's bias block if it is shared.
+	/// </summary>
+	/// <param name="node">Index of the node in the plan.</param>
+	/// <param name="bias">The new bias.</param>
+	void SetBias(uint32_t node, double bias);
+
+	/// <summary>
+	/// Sets the weight of a synapse, copying its layer's weight block if it is shared.
+	/// </summary>
+	/// <param name="synapse">Index of the synapse in the plan.</param>
+	/// <param name="weight">The new weight.</param>
+	void SetWeight(uint32_t synapse, double weight);
+
+	/// <summary>
+	/// Evaluates the plan.
+	/// </summary>
+	/// <param name="inputs">Pointer to the input values.</param>
+	/// <param name="inputCount">Number of input values, extra values are ignored and missing values are treated as 0.</param>
+	/// <param name="outputs">Pointer to the buffer the output values are written to.</param>
+	/// <param name="outputCount">Size of the output buffer, extra outputs are not written.</param>
+	void Evaluate(const double* inputs, size_t inputCount, double* outputs, size_t outputCount);
+	void Evaluate(const float* inputs, size_t inputCount, float* outputs, size_t outputCount);
+
+	/// <summary>
+	/// Evaluates the plan for a batch of inputs at once, dense layers are computed as one matrix-matrix product.
+	/// </summary>
+	/// <param name="inputs">Row major input matrix with one row per batch entry.</param>
+	/// <param name="inputStride">Number of values in each input row, extra values are ignored and missing values are treated as 0.</param>
+	/// <param name="outputs">Row major output matrix with one row per batch entry.</param>
+	/// <param name="outputStride">Number of values in each output row, extra outputs are not written.</param>
+	/// <param name="batch">Number of batch entries.</param>
+	/// <remarks>Every entry starts from the node values of the last single evaluation, the plan's values are left unchanged.</remarks>
+	void EvaluateBatch(const double* inputs, size_t inputStride, double* outputs, size_t outputStride, size_t batch);
+
+	/// <summary>
+	/// Evaluates the plan for a batch stored interleaved as [node][entry].
+	/// </summary>
+	/// <param name="preActivation">Summed bias and input of each node for each entry, the synapse inputs are added to it.</param>
+	/// <param name="values">Node values for each entry, holding the last evaluation on entry and this evaluation on return.</param>
+	/// <param name="batch">Number of batch entries.</param>
+	void EvaluateInterleaved(double* preActivation, double* values, size_t batch) const;
+	void EvaluateInterleaved(float* preActivation, float* values, size_t batch) const;
+
+	/// <summary>
+	/// Applies the activation functions of one layer, one span kernel call per run of nodes sharing a function.
+	/// </summary>
+	/// <param name="layer">Index of the layer.</param>
+	/// <param name="preActivation">Summed input of each node, interleaved as [node][entry].</param>
+	/// <param name="values">Buffer the node values are written to, interleaved as [node][entry].</param>
+	/// <param name="batch">Number of batch entries.</param>
+	void ActivateLayer(size_t layer, const double* preActivation, double* values, size_t batch) const;
+	void ActivateLayer(size_t layer, const float* preActivation, float* values, size_t batch) const;
+
+	/// <summary>
+	/// Gets the parameter arrays of one precision, only the arrays matching the plan's precision are filled.
+	/// </summary>
+	template<typename T>
+	PlanParameters<T>& Parameters()
+	{
+		if constexpr (std::is_same_v<T, float>) return float32; else return float64;
+	}
+	template<typename T>
+	const PlanParameters<T>& Parameters() const
+	{
+		if constexpr (std::is_same_v<T, float>) return float32; else return float64;
+	}
+
+	/// <summary>
+	/// Gets the value of a node from the last evaluation.
+	/// </summary>
+	double Value(size_t node) const;
+
+	/// <summary>
+	/// Checks whether another plan has the same nodes, activations and connections, so only the bias and weight values differ.
+	/// </summary>
+	/// <param name="other">The plan to compare against.</param>
+	/// <returns>True if the plans share a topology.</returns>
+	bool SameTopology(const CompiledNetwork& other) const;
+
+	/// <summary>
+	/// Gets the node and synapse layout of the plan.
+	/// </summary>
+	const PlanTopology& Topology() const { return *topology; }
+
+	size_t NodeCount() const { return topology->activationId.size(); }
+	size_t SynapseCount() const { return topology->synapseSource.size(); }
+	size_t LayerCount() const { return topology->layerStart.size() - 1; }
+	size_t InputCount() const { return topology->inputIndex.size(); }
+	size_t OutputCount() const { return topology->outputIndex.size(); }
+
+	Precision precision; // Precision the plan is evaluated in.
+	PlanParameters<double> float64; // Parameters of a double precision plan.
+	PlanParameters<float> float32; // Parameters of a single precision plan.
+
+	uint64_t id; // Unique id of the plan, a recompiled or patched plan always gets a new id.
+	uint64_t topologyHash = 0; // Hash of the topology arrays and precision, plans with the same topology have the same hash.
+
+private:
+	/// <summary>
+	/// Evaluates the plan in precision T, converting inputs and outputs.
+	/// </summary>
+	template<typename T, typename In, typename Out>
+	void EvaluateAs(const In* inputs, size_t inputCount, Out* outputs, size_t outputCount);
+
+	/// <summary>
+	/// Evaluates a batch of inputs in precision T.
+	/// </summary>
+	template<typename T>
+	void EvaluateBatchAs(const double* inputs, size_t inputStride, double* outputs, size_t outputStride, size_t batch);
+
+	/// <summary>
+	/// Sums and activates every layer for a batch stored interleaved as [node][entry].
+	/// </summary>
+	template<typename T>
+	void Propagate(const LayerBlocks<T>& weights, T* preActivation, T* values, size_t batch) const;
+
+	/// <summary>
+	/// Copies the bias of every node into an interleaved [node][entry] buffer.
+	/// </summary>
+	template<typename T>
+	void FillBias(T* preActivation, size_t batch) const;
+
+	/// <summary>
+	/// Applies the activation function runs of one layer.
+	/// </summary>
+	template<typename T>
+	void ActivateLayerAs(size_t layer, const T* preActivation, T* values, size_t batch) const;
+
+	/// <summary>
+	/// Sets a bias or weight in the parameter blocks of precision T.
+	/// </summary>
+	template<typename T>
+	void SetParameter(LayerBlocks<T>& blocks, const std::vector<uint32_t>& blockStart, uint32_t index, double value);
+
+	std::shared_ptr<const PlanTopology> topology; // Node and synapse layout, shared with forked plans.
+};
@@ -29,6 +29,7 @@ public:
 		int screenWidth = 1200;
 		int screenHeight = 800;
 		int targetFPS = 60;
+		uint64_t seed = 0; // Seed of every random stream in a run, 0 draws a new seed at startup
 	};
 	App app;
 	struct UI
@@ -54,6 +55,8 @@ public:
 		float agentBaseHealth = 2;
 		float updateDelta = 4;
 		float resetTime = 5;
+		size_t pipelineDepth = 1; // Steps between observing and acting, 1 acts on each step's own observation
+		bool gridBroadphase = false; // Uses a uniform grid instead of the KD tree for collisions and observations
 	};
 	Engine engine;
 
@@ -169,6 +172,7 @@ public:
 			if ((e = appElement->QueryIntAttribute("screenWidth", &app.screenWidth)) != tinyxml2::XML_SUCCESS) std::cerr << "ERROR: Failed to load config Attribute 'app.screenWidth' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl; else std::cerr << "INFO: Loaded config Attribute 'app.screenWidth'" << std::endl;
 			if ((e = appElement->QueryIntAttribute("screenHeight", &app.screenHeight)) != tinyxml2::XML_SUCCESS) std::cerr << "ERROR: Failed to load config Attribute 'app.screenHeight' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl; else std::cerr << "INFO: Loaded config Attribute 'app.screenHeight'" << std::endl;
 			if ((e = appElement->QueryIntAttribute("targetFPS", &app.targetFPS)) != tinyxml2::XML_SUCCESS) std::cerr << "ERROR: Failed to load config Attribute 'app.targetFPS' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl; else std::cerr << "INFO: Loaded config Attribute 'app.targetFPS'" << std::endl;
+			if ((e = appElement->QueryUnsigned64Attribute("seed", &app.seed)) != tinyxml2::XML_SUCCESS) std::cerr << "ERROR: Failed to load config Attribute 'app.seed' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl; else std::cerr << "INFO: Loaded config Attribute 'app.seed'" << std::endl;
 		}
 		else
 		{
@@ -245,6 +249,8 @@ public:
 			if ((e = engineElement->QueryFloatAttribute("AgentBaseHealth", &engine.agentBaseHealth)) != tinyxml2::XML_SUCCESS) std::cerr << "ERROR: Failed to load config Attribute 'engine.agentBaseHealth' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl; else std::cerr << "INFO: Loaded config Attribute 'engine.agentBaseHealth'" << std::endl;
 			if ((e = engineElement->QueryFloatAttribute("UpdateDelta", &engine.updateDelta)) != tinyxml2::XML_SUCCESS) std::cerr << "ERROR: Failed to load config Attribute 'engine.updateDelta' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl; else std::cerr << "INFO: Loaded config Attribute 'engine.updateDelta'" << std::endl;
 			if ((e = engineElement->QueryFloatAttribute("ResetTime", &engine.resetTime)) != tinyxml2::XML_SUCCESS) std::cerr << "ERROR: Failed to load config Attribute 'engine.resetTime' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl; else std::cerr << "INFO: Loaded config Attribute 'engine.resetTime'" << std::endl;
+			if ((e = engineElement->QueryUnsigned64Attribute("PipelineDepth", &engine.pipelineDepth)) != tinyxml2::XML_SUCCESS) std::cerr << "ERROR: Failed to load config Attribute 'engine.pipelineDepth' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl; else std::cerr << "INFO: Loaded config Attribute 'engine.pipelineDepth'" << std::endl;
+			if ((e = engineElement->QueryBoolAttribute("GridBroadphase", &engine.gridBroadphase)) != tinyxml2::XML_SUCCESS) std::cerr << "ERROR: Failed to load config Attribute 'engine.gridBroadphase' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl; else std::cerr << "INFO: Loaded config Attribute 'engine.gridBroadphase'" << std::endl;
 
 		}
 		else
@@ -290,6 +296,7 @@ public:
 		appElement->SetAttribute("screenWidth", app.screenWidth);
 		appElement->SetAttribute("screenHeight", app.screenHeight);
 		appElement->SetAttribute("targetFPS", app.targetFPS);
+		appElement->SetAttribute("seed", app.seed);
 		root->InsertEndChild(appElement);
 
 		// Save UI settings
@@ -344,6 +351,8 @@ public:
 		engineElement->SetAttribute("AgentBaseHealth", engine.agentBaseHealth);
 		engineElement->SetAttribute("UpdateDelta", engine.updateDelta);
 		engineElement->SetAttribute("ResetTime", engine.resetTime);
+		engineElement->SetAttribute("PipelineDepth", engine.pipelineDepth);
+		engineElement->SetAttribute("GridBroadphase", engine.gridBroadphase);
 		root->InsertEndChild(engineElement);
 
 		// Save hyperparameterCap
@@ -0,0 +1,49 @@
+#include "CpuFeatures.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/// <summary>
+/// Finds the best instruction set supported by the CPU and operating system
+/// </summary>
+static KernelLevel DetectKernelLevel()
+{
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+	__cpuid(info, 1);
+	const bool sse2 = info[3] & (1 << 26);
+	const bool fma = info[2] & (1 << 12);
+	const bool osxsave = info[2] & (1 << 27);
+	const bool avx = info[2] & (1 << 28);
+	bool avx2 = false;
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = info[1] & (1 << 5);
+	}
+	// The OS has to save the upper halves of the ymm registers on context switches
+	const bool osAvx = osxsave && (_xgetbv(0) & 6) == 6;
+	if (avx && avx2 && fma && osAvx)
+	{
+		return KernelLevel::AVX2;
+	}
+	return sse2 ? KernelLevel::SSE2 : KernelLevel::Scalar;
+#elif defined(KERNELS_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		return KernelLevel::AVX2;
+	}
+	return __builtin_cpu_supports("sse2") ? KernelLevel::SSE2 : KernelLevel::Scalar;
+#else
+	return KernelLevel::Scalar;
+#endif
+}
+
+KernelLevel GetKernelLevel()
+{
+	static const KernelLevel level = DetectKernelLevel();
+	return level;
+}
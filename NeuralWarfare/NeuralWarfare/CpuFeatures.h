@@ -0,0 +1,31 @@
+#pragma once
+
+// Runtime instruction set detection shared by the SIMD kernels.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+// MSVC allows any intrinsic in any function, the instruction set is only checked at runtime
+#define TARGET_AVX2
+#define TARGET_SSE2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+#endif
+
+/// <summary>
+/// Instruction sets the kernels can use
+/// </summary>
+enum class KernelLevel
+{
+	Scalar,
+	SSE2,
+	AVX2,
+};
+
+/// <summary>
+/// Gets the best instruction set supported by the CPU and operating system, detected once on first use
+/// </summary>
+KernelLevel GetKernelLevel();
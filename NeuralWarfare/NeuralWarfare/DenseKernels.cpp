@@ -0,0 +1,433 @@
+#include "DenseKernels.h"
+#include "CpuFeatures.h"
+
+// Scalar kernels for both precisions, used on CPUs without SSE2 and for the tails of the vector kernels
+
+template<typename T>
+static void DenseMatVecScalar(const T* weights, size_t rows, size_t cols, const T* x, T* y)
+{
+	for (size_t r = 0; r < rows; r++)
+	{
+		const T* row = weights + r * cols;
+		T sum = 0;
+		for (size_t c = 0; c < cols; c++)
+		{
+			sum += row[c] * x[c];
+		}
+		y[r] += sum;
+	}
+}
+
+template<typename T>
+static void DenseMatMatScalar(const T* weights, size_t rows, size_t cols, const T* x, size_t xStride, T* y, size_t yStride, size_t batch)
+{
+	for (size_t r = 0; r < rows; r++)
+	{
+		const T* row = weights + r * cols;
+		T* yRow = y + r * yStride;
+		for (size_t c = 0; c < cols; c++)
+		{
+			const T w = row[c];
+			const T* xRow = x + c * xStride;
+			for (size_t b = 0; b < batch; b++)
+			{
+				yRow[b] += w * xRow[b];
+			}
+		}
+	}
+}
+
+template<typename T>
+static void VectorMultiplyAddScalar(const T* a, const T* b, T* y, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		y[i] += a[i] * b[i];
+	}
+}
+
+template<typename T>
+static void VectorScaleAddScalar(T scale, const T* x, T* y, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		y[i] += scale * x[i];
+	}
+}
+
+#ifdef KERNELS_X86
+
+// SSE2 kernels, two doubles per register
+
+TARGET_SSE2 static void DenseMatVecSSE2(const double* weights, size_t rows, size_t cols, const double* x, double* y)
+{
+	for (size_t r = 0; r < rows; r++)
+	{
+		const double* row = weights + r * cols;
+		__m128d acc0 = _mm_setzero_pd();
+		__m128d acc1 = _mm_setzero_pd();
+		size_t c = 0;
+		for (; c + 4 <= cols; c += 4)
+		{
+			acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(row + c), _mm_loadu_pd(x + c)));
+			acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(row + c + 2), _mm_loadu_pd(x + c + 2)));
+		}
+		for (; c + 2 <= cols; c += 2)
+		{
+			acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(row + c), _mm_loadu_pd(x + c)));
+		}
+		acc0 = _mm_add_pd(acc0, acc1);
+		double sum = _mm_cvtsd_f64(_mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0)));
+		for (; c < cols; c++)
+		{
+			sum += row[c] * x[c];
+		}
+		y[r] += sum;
+	}
+}
+
+TARGET_SSE2 static void DenseMatMatSSE2(const double* weights, size_t rows, size_t cols, const double* x, size_t xStride, double* y, size_t yStride, size_t batch)
+{
+	for (size_t r = 0; r < rows; r++)
+	{
+		const double* row = weights + r * cols;
+		double* yRow = y + r * yStride;
+		size_t b = 0;
+		for (; b + 2 <= batch; b += 2)
+		{
+			__m128d acc = _mm_loadu_pd(yRow + b);
+			for (size_t c = 0; c < cols; c++)
+			{
+				acc = _mm_add_pd(acc, _mm_mul_pd(_mm_set1_pd(row[c]), _mm_loadu_pd(x + c * xStride + b)));
+			}
+			_mm_storeu_pd(yRow + b, acc);
+		}
+		for (; b < batch; b++)
+		{
+			double sum = yRow[b];
+			for (size_t c = 0; c < cols; c++)
+			{
+				sum += row[c] * x[c * xStride + b];
+			}
+			yRow[b] = sum;
+		}
+	}
+}
+
+TARGET_SSE2 static void VectorMultiplyAddSSE2(const double* a, const double* b, double* y, size_t count)
+{
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		_mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))));
+	}
+	VectorMultiplyAddScalar(a + i, b + i, y + i, count - i);
+}
+
+TARGET_SSE2 static void VectorScaleAddSSE2(double scale, const double* x, double* y, size_t count)
+{
+	const __m128d s = _mm_set1_pd(scale);
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		_mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(s, _mm_loadu_pd(x + i))));
+	}
+	VectorScaleAddScalar(scale, x + i, y + i, count - i);
+}
+
+// AVX2 kernels, four doubles per register with fused multiply-add
+
+TARGET_AVX2 static void DenseMatVecAVX2(const double* weights, size_t rows, size_t cols, const double* x, double* y)
+{
+	for (size_t r = 0; r < rows; r++)
+	{
+		const double* row = weights + r * cols;
+		__m256d acc0 = _mm256_setzero_pd();
+		__m256d acc1 = _mm256_setzero_pd();
+		size_t c = 0;
+		for (; c + 8 <= cols; c += 8)
+		{
+			acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(row + c), _mm256_loadu_pd(x + c), acc0);
+			acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(row + c + 4), _mm256_loadu_pd(x + c + 4), acc1);
+		}
+		for (; c + 4 <= cols; c += 4)
+		{
+			acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(row + c), _mm256_loadu_pd(x + c), acc0);
+		}
+		acc0 = _mm256_add_pd(acc0, acc1);
+		__m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+		double sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+		for (; c < cols; c++)
+		{
+			sum += row[c] * x[c];
+		}
+		y[r] += sum;
+	}
+}
+
+TARGET_AVX2 static void DenseMatMatAVX2(const double* weights, size_t rows, size_t cols, const double* x, size_t xStride, double* y, size_t yStride, size_t batch)
+{
+	for (size_t r = 0; r < rows; r++)
+	{
+		const double* row = weights + r * cols;
+		double* yRow = y + r * yStride;
+		size_t b = 0;
+		for (; b + 8 <= batch; b += 8)
+		{
+			__m256d acc0 = _mm256_loadu_pd(yRow + b);
+			__m256d acc1 = _mm256_loadu_pd(yRow + b + 4);
+			for (size_t c = 0; c < cols; c++)
+			{
+				const __m256d w = _mm256_broadcast_sd(row + c);
+				const double* xRow = x + c * xStride + b;
+				acc0 = _mm256_fmadd_pd(w, _mm256_loadu_pd(xRow), acc0);
+				acc1 = _mm256_fmadd_pd(w, _mm256_loadu_pd(xRow + 4), acc1);
+			}
+			_mm256_storeu_pd(yRow + b, acc0);
+			_mm256_storeu_pd(yRow + b + 4, acc1);
+		}
+		for (; b + 4 <= batch; b += 4)
+		{
+			__m256d acc = _mm256_loadu_pd(yRow + b);
+			for (size_t c = 0; c < cols; c++)
+			{
+				acc = _mm256_fmadd_pd(_mm256_broadcast_sd(row + c), _mm256_loadu_pd(x + c * xStride + b), acc);
+			}
+			_mm256_storeu_pd(yRow + b, acc);
+		}
+		for (; b < batch; b++)
+		{
+			double sum = yRow[b];
+			for (size_t c = 0; c < cols; c++)
+			{
+				sum += row[c] * x[c * xStride + b];
+			}
+			yRow[b] = sum;
+		}
+	}
+}
+
+TARGET_AVX2 static void VectorMultiplyAddAVX2(const double* a, const double* b, double* y, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm256_storeu_pd(y + i, _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _mm256_loadu_pd(y + i)));
+	}
+	VectorMultiplyAddScalar(a + i, b + i, y + i, count - i);
+}
+
+TARGET_AVX2 static void VectorScaleAddAVX2(double scale, const double* x, double* y, size_t count)
+{
+	const __m256d s = _mm256_set1_pd(scale);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm256_storeu_pd(y + i, _mm256_fmadd_pd(s, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+	}
+	VectorScaleAddScalar(scale, x + i, y + i, count - i);
+}
+
+// AVX2 kernels for single precision, eight floats per register
+
+TARGET_AVX2 static void DenseMatVecAVX2(const float* weights, size_t rows, size_t cols, const float* x, float* y)
+{
+	for (size_t r = 0; r < rows; r++)
+	{
+		const float* row = weights + r * cols;
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		size_t c = 0;
+		for (; c + 16 <= cols; c += 16)
+		{
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(row + c), _mm256_loadu_ps(x + c), acc0);
+			acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(row + c + 8), _mm256_loadu_ps(x + c + 8), acc1);
+		}
+		for (; c + 8 <= cols; c += 8)
+		{
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(row + c), _mm256_loadu_ps(x + c), acc0);
+		}
+		acc0 = _mm256_add_ps(acc0, acc1);
+		__m128 half = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+		half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+		float sum = _mm_cvtss_f32(_mm_add_ss(half, _mm_movehdup_ps(half)));
+		for (; c < cols; c++)
+		{
+			sum += row[c] * x[c];
+		}
+		y[r] += sum;
+	}
+}
+
+TARGET_AVX2 static void DenseMatMatAVX2(const float* weights, size_t rows, size_t cols, const float* x, size_t xStride, float* y, size_t yStride, size_t batch)
+{
+	for (size_t r = 0; r < rows; r++)
+	{
+		const float* row = weights + r * cols;
+		float* yRow = y + r * yStride;
+		size_t b = 0;
+		for (; b + 16 <= batch; b += 16)
+		{
+			__m256 acc0 = _mm256_loadu_ps(yRow + b);
+			__m256 acc1 = _mm256_loadu_ps(yRow + b + 8);
+			for (size_t c = 0; c < cols; c++)
+			{
+				const __m256 w = _mm256_broadcast_ss(row + c);
+				const float* xRow = x + c * xStride + b;
+				acc0 = _mm256_fmadd_ps(w, _mm256_loadu_ps(xRow), acc0);
+				acc1 = _mm256_fmadd_ps(w, _mm256_loadu_ps(xRow + 8), acc1);
+			}
+			_mm256_storeu_ps(yRow + b, acc0);
+			_mm256_storeu_ps(yRow + b + 8, acc1);
+		}
+		for (; b + 8 <= batch; b += 8)
+		{
+			__m256 acc = _mm256_loadu_ps(yRow + b);
+			for (size_t c = 0; c < cols; c++)
+			{
+				acc = _mm256_fmadd_ps(_mm256_broadcast_ss(row + c), _mm256_loadu_ps(x + c * xStride + b), acc);
+			}
+			_mm256_storeu_ps(yRow + b, acc);
+		}
+		for (; b < batch; b++)
+		{
+			float sum = yRow[b];
+			for (size_t c = 0; c < cols; c++)
+			{
+				sum += row[c] * x[c * xStride + b];
+			}
+			yRow[b] = sum;
+		}
+	}
+}
+
+TARGET_AVX2 static void VectorMultiplyAddAVX2(const float* a, const float* b, float* y, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm256_storeu_ps(y + i, _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _mm256_loadu_ps(y + i)));
+	}
+	VectorMultiplyAddScalar(a + i, b + i, y + i, count - i);
+}
+
+TARGET_AVX2 static void VectorScaleAddAVX2(float scale, const float* x, float* y, size_t count)
+{
+	const __m256 s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm256_storeu_ps(y + i, _mm256_fmadd_ps(s, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+	}
+	VectorScaleAddScalar(scale, x + i, y + i, count - i);
+}
+
+#endif
+
+void DenseMatVec(const double* weights, size_t rows, size_t cols, const double* x, double* y)
+{
+#ifdef KERNELS_X86
+	switch (GetKernelLevel())
+	{
+	case KernelLevel::AVX2:
+		return DenseMatVecAVX2(weights, rows, cols, x, y);
+	case KernelLevel::SSE2:
+		return DenseMatVecSSE2(weights, rows, cols, x, y);
+	default:
+		break;
+	}
+#endif
+	DenseMatVecScalar(weights, rows, cols, x, y);
+}
+
+void DenseMatMat(const double* weights, size_t rows, size_t cols, const double* x, size_t xStride, double* y, size_t yStride, size_t batch)
+{
+#ifdef KERNELS_X86
+	switch (GetKernelLevel())
+	{
+	case KernelLevel::AVX2:
+		return DenseMatMatAVX2(weights, rows, cols, x, xStride, y, yStride, batch);
+	case KernelLevel::SSE2:
+		return DenseMatMatSSE2(weights, rows, cols, x, xStride, y, yStride, batch);
+	default:
+		break;
+	}
+#endif
+	DenseMatMatScalar(weights, rows, cols, x, xStride, y, yStride, batch);
+}
+
+void VectorMultiplyAdd(const double* a, const double* b, double* y, size_t count)
+{
+#ifdef KERNELS_X86
+	switch (GetKernelLevel())
+	{
+	case KernelLevel::AVX2:
+		return VectorMultiplyAddAVX2(a, b, y, count);
+	case KernelLevel::SSE2:
+		return VectorMultiplyAddSSE2(a, b, y, count);
+	default:
+		break;
+	}
+#endif
+	VectorMultiplyAddScalar(a, b, y, count);
+}
+
+void VectorScaleAdd(double scale, const double* x, double* y, size_t count)
+{
+#ifdef KERNELS_X86
+	switch (GetKernelLevel())
+	{
+	case KernelLevel::AVX2:
+		return VectorScaleAddAVX2(scale, x, y, count);
+	case KernelLevel::SSE2:
+		return VectorScaleAddSSE2(scale, x, y, count);
+	default:
+		break;
+	}
+#endif
+	VectorScaleAddScalar(scale, x, y, count);
+}
+
+void DenseMatVec(const float* weights, size_t rows, size_t cols, const float* x, float* y)
+{
+#ifdef KERNELS_X86
+	if (GetKernelLevel() == KernelLevel::AVX2)
+	{
+		return DenseMatVecAVX2(weights, rows, cols, x, y);
+	}
+#endif
+	DenseMatVecScalar(weights, rows, cols, x, y);
+}
+
+void DenseMatMat(const float* weights, size_t rows, size_t cols, const float* x, size_t xStride, float* y, size_t yStride, size_t batch)
+{
+#ifdef KERNELS_X86
+	if (GetKernelLevel() == KernelLevel::AVX2)
+	{
+		return DenseMatMatAVX2(weights, rows, cols, x, xStride, y, yStride, batch);
+	}
+#endif
+	DenseMatMatScalar(weights, rows, cols, x, xStride, y, yStride, batch);
+}
+
+void VectorMultiplyAdd(const float* a, const float* b, float* y, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetKernelLevel() == KernelLevel::AVX2)
+	{
+		return VectorMultiplyAddAVX2(a, b, y, count);
+	}
+#endif
+	VectorMultiplyAddScalar(a, b, y, count);
+}
+
+void VectorScaleAdd(float scale, const float* x, float* y, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetKernelLevel() == KernelLevel::AVX2)
+	{
+		return VectorScaleAddAVX2(scale, x, y, count);
+	}
+#endif
+	VectorScaleAddScalar(scale, x, y, count);
+}
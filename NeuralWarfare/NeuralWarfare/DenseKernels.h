@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+
+// SIMD kernels used by the compiled network for dense (fully connected) layer blocks.
+// Each kernel picks an AVX2, SSE2 or scalar implementation at runtime based on what the CPU supports.
+// The float overloads used by single precision plans have AVX2 and scalar implementations.
+
+/// <summary>
+/// Dense matrix-vector multiply, y += W * x
+/// </summary>
+/// <param name="weights"> row major matrix of rows * cols weights</param>
+/// <param name="rows"> number of rows in the matrix and values in y</param>
+/// <param name="cols"> number of columns in the matrix and values in x</param>
+/// <param name="x"> input vector</param>
+/// <param name="y"> output vector, the product is added to its existing values</param>
+void DenseMatVec(const double* weights, size_t rows, size_t cols, const double* x, double* y);
+
+/// <summary>
+/// Dense matrix-matrix multiply for a batch of inputs, Y += W * X
+/// </summary>
+/// <param name="weights"> row major matrix of rows * cols weights</param>
+/// <param name="rows"> number of rows in the matrix and in Y</param>
+/// <param name="cols"> number of columns in the matrix and rows in X</param>
+/// <param name="x"> input matrix, row c holds input c for every batch entry</param>
+/// <param name="xStride"> distance between rows of X</param>
+/// <param name="y"> output matrix, row r holds output r for every batch entry, the product is added to its existing values</param>
+/// <param name="yStride"> distance between rows of Y</param>
+/// <param name="batch"> number of batch entries (columns of X and Y)</param>
+void DenseMatMat(const double* weights, size_t rows, size_t cols, const double* x, size_t xStride, double* y, size_t yStride, size_t batch);
+
+/// <summary>
+/// Element wise multiply-add, y[i] += a[i] * b[i]
+/// </summary>
+void VectorMultiplyAdd(const double* a, const double* b, double* y, size_t count);
+
+/// <summary>
+/// Scaled vector add, y[i] += scale * x[i]
+/// </summary>
+void VectorScaleAdd(double scale, const double* x, double* y, size_t count);
+
+void DenseMatVec(const float* weights, size_t rows, size_t cols, const float* x, float* y);
+void DenseMatMat(const float* weights, size_t rows, size_t cols, const float* x, size_t xStride, float* y, size_t yStride, size_t batch);
+void VectorMultiplyAdd(const float* a, const float* b, float* y, size_t count);
+void VectorScaleAdd(float scale, const float* x, float* y, size_t count);
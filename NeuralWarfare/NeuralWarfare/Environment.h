@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <list>
+#include <cstddef>
 
 /// <summary>
 /// Mostly abstract class that defines methods a learning algorithm expects the Environment to have.
@@ -13,7 +14,7 @@ public:
 	/// <summary>
 	/// Stores information for an AI to use to decide its next action.
 	/// </summary>
-	static class Observation
+	class Observation
 	{
 	public:
 		Observation() {};
@@ -22,7 +23,19 @@ public:
 		/// Converts the information for use by a neural network.
 		/// </summary>
 		/// <returns>The inputs for a neural network</returns>
-		virtual std::vector<double> GetForNN() = 0;
+		std::vector<double> GetForNN()
+		{
+			std::vector<double> inputs(NNInputSize());
+			GetForNN(inputs.data(), inputs.size());
+			return inputs;
+		}
+
+		/// <summary>
+		/// Writes the information for use by a neural network into a caller owned buffer, without allocating.
+		/// </summary>
+		/// <param name="inputs"> buffer for the inputs of a neural network</param>
+		/// <param name="count"> size of the buffer, values past NNInputSize are left untouched</param>
+		virtual void GetForNN(double* inputs, size_t count) = 0;
 
 		virtual size_t NNInputSize() = 0;
 
@@ -33,7 +46,7 @@ public:
 	/// <summary>
 	/// Stores the information resulting from a step.
 	/// </summary>
-	static class StepResult
+	class StepResult
 	{
 	public:
 
@@ -94,7 +107,14 @@ public:
 
 		virtual size_t NNOutputSize() = 0;
 
-		virtual void GetFromNN(std::vector<double> outputs) = 0;
+		void GetFromNN(const std::vector<double>& outputs) { GetFromNN(outputs.data(), outputs.size()); }
+
+		/// <summary>
+		/// Reads the action from the outputs of a neural network, without allocating.
+		/// </summary>
+		/// <param name="outputs"> outputs of the neural network</param>
+		/// <param name="count"> number of outputs</param>
+		virtual void GetFromNN(const double* outputs, size_t count) = 0;
 		
 		virtual void GetFromTest(double value) = 0;
 
@@ -113,7 +133,21 @@ public:
 	/// Function to get the result of the last action preformed
 	/// </summary>
 	/// <returns>array of StepResult from the last taken action</returns>
-	virtual std::list <StepResult>* GetResult() = 0;
+	std::list<StepResult>* GetResult()
+	{
+		std::list<StepResult>* results = new std::list<StepResult>();
+		GetResult(*results);
+		return results;
+	}
+
+	/// <summary>
+	/// Function to get the result of the last action preformed into an existing list.
+	/// </summary>
+	/// <remarks>
+	/// Step results and observations already in the list are refreshed in place, so calling this every step with the same list does not allocate.
+	/// </remarks>
+	/// <param name="results"> array of StepResult from the last taken action, filled by a previous call to this function or empty</param>
+	virtual void GetResult(std::list<StepResult>& results) = 0;
 
 	/// <summary>
 	/// Function to reset the environment
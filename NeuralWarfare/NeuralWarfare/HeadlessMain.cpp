@@ -0,0 +1,316 @@
+// Headless training runner: trains teams without opening a window, as fast as the machine allows.
+// It uses the same config and hyperparameter files as the application and writes its models to the
+// model folder, so they can be watched and tested in the application afterwards.
+//
+// Usage: NeuralWarfareHeadless [options]
+//   --config <file>           config file, default config.xml
+//   --hyperparameters <file>  hyperparameter file, default hyperperameters.xml
+//   --generations <count>     stop once every trainer has evolved this many generations
+//   --time <seconds>          stop after this much wall clock time
+//   --teams <count>           number of teams trained against each other, default 2
+//   --model <name>            model in the model folder every team starts from, default a new model
+//   --name <name>             name the models are saved under, default Headless
+//   --checkpoint <count>      generations between checkpoints, 0 saves only at the end, default 10
+//   --precision <name>        float64 or float32, precision the networks are evaluated in, default from the hyperparameters
+//   --check-allocations <0|1> fail once a steady state step allocates, default 0
+// Without --generations or --time the run stops after 100 generations.
+// Steps after the first episode are steady state, except the first step of each episode where the trainers evolve.
+// The most heap allocations the trainers made in such a step is logged with every generation and should be 0.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Configs.h"
+#include "NeuralWarfareEngine.h"
+#include "NeuralWarfareEnv.h"
+#include "NeuralWarfareTrainers.h"
+#include "ActivationFunctions.h"
+#include "RandomStream.h"
+#include "StepPipeline.h"
+
+/// <summary>
+/// Options of a headless run, read from the command line
+/// </summary>
+struct HeadlessOptions
+{
+	std::string configPath = "config.xml";
+	std::string hyperparameterPath = "hyperperameters.xml";
+	size_t generations = 0;
+	double seconds = 0;
+	size_t teams = 2;
+	std::string model;
+	std::string name = "Headless";
+	size_t checkpointInterval = 10;
+	bool overridePrecision = false; // Set by --precision, otherwise the hyperparameter file decides
+	Precision precision = Precision::Float64;
+	bool checkAllocations = false;
+};
+
+/// <summary>
+/// Reads a whole option value as a count, throws std::invalid_argument or std::out_of_range if it is not one
+/// </summary>
+static size_t ReadCount(const std::string& value)
+{
+	size_t end = 0;
+	// stoull accepts a minus sign and wraps the value around, a count is never negative
+	size_t count = value.find('-') == std::string::npos ? std::stoull(value, &end) : 0;
+	if (end == 0 || end != value.size())
+	{
+		throw std::invalid_argument(value);
+	}
+	return count;
+}
+
+/// <summary>
+/// Reads a whole option value as a number of seconds, throws std::invalid_argument or std::out_of_range if it is not one
+/// </summary>
+static double ReadSeconds(const std::string& value)
+{
+	size_t end = 0;
+	double seconds = std::stod(value, &end);
+	if (end != value.size())
+	{
+		throw std::invalid_argument(value);
+	}
+	return seconds;
+}
+
+/// <summary>
+/// Reads the options, returns false and prints the usage if an option is unknown, missing its value or its value is malformed
+/// </summary>
+static bool ParseOptions(int argc, char** argv, HeadlessOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		if (i + 1 >= argc)
+		{
+			std::cerr << "ERROR: Option '" << option << "' needs a value" << std::endl;
+			return false;
+		}
+		std::string value = argv[++i];
+		try
+		{
+			if (option == "--config") options.configPath = value;
+			else if (option == "--hyperparameters") options.hyperparameterPath = value;
+			else if (option == "--generations") options.generations = ReadCount(value);
+			else if (option == "--time") options.seconds = ReadSeconds(value);
+			else if (option == "--teams") options.teams = std::max<size_t>(1, ReadCount(value));
+			else if (option == "--model") options.model = value;
+			else if (option == "--name") options.name = value;
+			else if (option == "--checkpoint") options.checkpointInterval = ReadCount(value);
+			else if (option == "--precision")
+			{
+				if (!ParsePrecision(value, options.precision))
+				{
+					std::cerr << "ERROR: Unknown precision '" << value << "', expected float64 or float32" << std::endl;
+					return false;
+				}
+				options.overridePrecision = true;
+			}
+			else if (option == "--check-allocations") options.checkAllocations = ReadCount(value) != 0;
+			else
+			{
+				std::cerr << "ERROR: Unknown option '" << option << "'" << std::endl;
+				return false;
+			}
+		}
+		catch (const std::invalid_argument&)
+		{
+			std::cerr << "ERROR: Option '" << option << "' expects a number, got '" << value << "'" << std::endl;
+			return false;
+		}
+		catch (const std::out_of_range&)
+		{
+			std::cerr << "ERROR: Value '" << value << "' of option '" << option << "' is out of range" << std::endl;
+			return false;
+		}
+	}
+	if (options.generations == 0 && options.seconds <= 0)
+	{
+		options.generations = 100;
+	}
+	return true;
+}
+
+/// <summary>
+/// Saves the best network of every trainer as name-team[-suffix].bin in the model folder
+/// </summary>
+static void SaveModels(const std::vector<GeneticAlgorithmNNTrainer*>& trainers, const std::filesystem::path& modelFolder, const std::string& name, const std::string& suffix)
+{
+	std::filesystem::create_directories(modelFolder);
+	for (size_t i = 0; i < trainers.size(); i++)
+	{
+		std::string modelName = name + "-team" + std::to_string(i) + suffix;
+		NeuralNetwork::Save(*trainers[i]->masterNetwork, modelFolder / MakeFilename(modelName, "bin"));
+		std::cerr << "INFO: Saved model '" << modelName << "'" << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	HeadlessOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		std::cerr << "Usage: NeuralWarfareHeadless [--config file] [--hyperparameters file] [--generations count] [--time seconds]"
+			" [--teams count] [--model name] [--name name] [--checkpoint count] [--precision float64|float32]"
+			" [--check-allocations 0|1]" << std::endl;
+		return 1;
+	}
+
+	Config config(options.configPath);
+	uint64_t seed = ResolveRunSeed(config.app.seed);
+	std::cerr << "INFO: Run seed " << seed << std::endl;
+
+	AddFunction addFunction;
+	TanhFunction tanhFunction;
+	SigmoidFunction sigmoidFunction;
+	std::vector<ActivationFunction*> functions{ &addFunction, &tanhFunction, &sigmoidFunction };
+
+	NeuralWarfareEngine eng(seed, { config.engine.sizeX, config.engine.sizeY });
+	eng.SetBroadphase(config.engine.gridBroadphase ? NeuralWarfareEngine::Broadphase::Grid : NeuralWarfareEngine::Broadphase::Tree);
+	std::vector<NeuralWarfareEnv*> envs;
+	std::vector<Trainer*> trainers;
+	std::vector<GeneticAlgorithmNNTrainer*> gaTrainers;
+	std::filesystem::path modelFolder = config.filePaths.modelFolder;
+
+	for (size_t t = 0; t < options.teams; t++)
+	{
+		NeuralNetwork* network;
+		if (options.model.empty())
+		{
+			// Same starting network as a new model in the training screen
+			network = new NeuralNetwork(functions);
+			size_t inputSize = NeuralWarfareEnv::MyObservation(eng, NeuralWarfareEngine::noAgent).NNInputSize();
+			size_t outputSize = NeuralWarfareEnv::MyAction(0).NNOutputSize();
+			for (size_t i = 0; i < inputSize; i++)
+			{
+				network->AddInput(new (network) Node(nullptr, &addFunction));
+			}
+			for (size_t i = 0; i < outputSize; i++)
+			{
+				network->AddOutput(new (network) Node(nullptr, &sigmoidFunction));
+			}
+		}
+		else
+		{
+			std::filesystem::path modelPath = modelFolder / MakeFilename(options.model, "bin");
+			if (!std::filesystem::exists(modelPath))
+			{
+				std::cerr << "ERROR: Model '" << options.model << "' not found in model folder" << std::endl;
+				return 1;
+			}
+			network = NeuralNetwork::Load(functions, modelPath);
+		}
+
+		GeneticAlgorithmNNTrainer::MyHyperparameters hyperparameters(options.hyperparameterPath);
+		if (options.overridePrecision)
+		{
+			hyperparameters.precision = options.precision;
+		}
+		size_t teamId = eng.AddTeam(config.engine.teamSize, config.engine.agentBaseHealth, { 0,0 });
+		NeuralWarfareEnv* env = new NeuralWarfareEnv(eng, teamId);
+		uint64_t trainerSeed = RandomStream(seed, 0, static_cast<uint32_t>(teamId), RandomPurpose::Trainer).Next64();
+		GeneticAlgorithmNNTrainer* trainer = new GeneticAlgorithmNNTrainer(env, trainerSeed, hyperparameters, network);
+		trainer->training = true;
+		envs.push_back(env);
+		trainers.push_back(trainer);
+		gaTrainers.push_back(trainer);
+	}
+	if (envs.size() > 1)
+	{
+		for (size_t i = 0; i < envs.size(); i++)
+		{
+			double angle = 2 * std::numbers::pi * i / envs.size();
+			envs[i]->SetTeamSpawnPos(Vec2{ static_cast<float>(config.engine.sizeX * 0.5 * cos(angle)) , static_cast<float>(config.engine.sizeY * 0.5 * sin(angle)) } * -1);
+		}
+	}
+
+	StepPipeline stepPipeline(eng, trainers, config.engine.pipelineDepth);
+	auto start = std::chrono::steady_clock::now();
+	auto elapsedSeconds = [&start]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+	// Episodes last as long as in the training screen, which advances resetTime by 1/60 per step
+	const size_t stepsPerEpisode = std::max<size_t>(1, static_cast<size_t>(config.engine.resetTime * 60));
+	size_t steps = 0;
+	size_t episodeSteps = 0;
+	size_t episodes = 0;
+	size_t steadyAllocations = 0; // Most allocations of a steady state step since the last generation was logged
+	uint32_t lastGeneration = 0;
+	while (true)
+	{
+		if (++episodeSteps > stepsPerEpisode)
+		{
+			for (NeuralWarfareEnv* env : envs)
+			{
+				env->UpdateKillTrackers();
+				env->Reset();
+			}
+			eng.Reset();
+			episodeSteps = 0;
+			episodes++;
+		}
+		stepPipeline.Step(config.engine.updateDelta);
+		steps++;
+
+		if (episodes > 0 && episodeSteps > 0)
+		{
+			size_t allocations = 0;
+			for (Trainer* trainer : trainers)
+			{
+				allocations += trainer->stepAllocations;
+			}
+			steadyAllocations = std::max(steadyAllocations, allocations);
+			if (options.checkAllocations && allocations)
+			{
+				std::cerr << "ERROR: Step " << steps << " allocated " << allocations << " times in steady state" << std::endl;
+				return 1;
+			}
+		}
+
+		uint32_t generation = gaTrainers.front()->GetGeneration();
+		for (GeneticAlgorithmNNTrainer* trainer : gaTrainers)
+		{
+			generation = std::min(generation, trainer->GetGeneration());
+		}
+		if (generation != lastGeneration)
+		{
+			lastGeneration = generation;
+			std::cerr << "INFO: Generation " << generation << " after " << steps << " steps, " << elapsedSeconds() << "s, "
+				<< steps / elapsedSeconds() << " steps/s, " << steadyAllocations << " allocations in a steady step, kills last episode";
+			for (NeuralWarfareEnv* env : envs)
+			{
+				std::cerr << " " << env->GetTotalKillsThisEpisode();
+			}
+			std::cerr << std::endl;
+			steadyAllocations = 0;
+			if (options.checkpointInterval && generation % options.checkpointInterval == 0)
+			{
+				SaveModels(gaTrainers, modelFolder, options.name, "-gen" + std::to_string(generation));
+			}
+		}
+
+		if ((options.generations && generation >= options.generations) || (options.seconds > 0 && elapsedSeconds() >= options.seconds))
+		{
+			break;
+		}
+	}
+
+	SaveModels(gaTrainers, modelFolder, options.name, "");
+	std::cerr << "INFO: Finished after " << lastGeneration << " generations, " << steps << " steps, " << elapsedSeconds() << "s" << std::endl;
+
+	for (Trainer* trainer : trainers)
+	{
+		delete trainer;
+	}
+	for (NeuralWarfareEnv* env : envs)
+	{
+		delete env;
+	}
+	return 0;
+}
@@ -1,8 +1,11 @@
 #pragma once
 #include <vector>
 #include "Vec2.h"
-#include <queue>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <functional>
+#include "ThreadPool.h"
 
 /// <summary>
 /// Objects used in a K-D tree require a member 'pos' that is convertible to a vec2
@@ -23,20 +26,24 @@ concept Object = requires(T a)
 /// <typeparam name="Obj"> must satisfy the requirements of the Object concept</typeparam>
 /// <remarks>
 /// This is a new one for me so i had a blast
+/// The tree is implicit: Build partitions one array in place, the point of a subtree is the middle element of its
+/// range and its children are the ranges either side. Rebuilding reuses the array, so it allocates nothing once the
+/// array has grown and there are no nodes to delete. Entries carry a copy of their position so partitioning does not
+/// chase pointers, queries read the live position of the obj.
 /// </remarks>
 template<Object Obj>
 class KDTree {
 public:
 
     /// <summary>
-    /// Simple struct required by priority_queue to determine what object has the highest value
+    /// Simple struct required by the heap functions to determine what object has the highest value
     /// </summary>
     struct CompareDist {
         bool operator()(const std::pair<double, Obj*>& a, const std::pair<double, Obj*>& b) const {
             return a.first < b.first;
         }
     };
-    using MaxHeap = std::priority_queue<std::pair<double, Obj*>, std::vector<std::pair<double, Obj*>>, CompareDist>; // Max heap data structure meaning it always keeps the largest element at the top
+    using MaxHeap = std::vector<std::pair<double, Obj*>>; // Max heap kept with std::push_heap and std::pop_heap, the largest element is at the front. A plain vector so callers can reuse its storage
     
     /// <summary>
     /// A function to be passed a param, used to determine whether given pointer is valid for return
@@ -51,7 +58,6 @@ public:
     /// KDTree constructor
     /// </summary>
     KDTree() {
-        root = nullptr;
     }
 
     /// <summary>
@@ -59,15 +65,16 @@ public:
     /// </summary>
     /// <param name="points"> array</param>
     KDTree(const std::vector<Obj*>& points) {
-        root = Build(points, 0);
+        Build(points);
     }
 
     /// <summary>
-    /// KDTree destructor
+    /// A point of the tree
     /// </summary>
-    ~KDTree() {
-        Clear(root);
-    }
+    struct Entry {
+        Vec2 pos; // position of the obj when the tree was built, used to partition
+        Obj* object;
+    };
 
     /// <summary>
     /// Finds the nearest Neighbors to a query position
@@ -78,6 +85,118 @@ public:
     /// <returns>array of neighbors</returns>
     std::vector<Obj*> FindNearestNeighbors(const Vec2& query, size_t k, Condition condition = [](const Obj* a) { return true; });
 
+    /// <summary>
+    /// Finds the nearest Neighbors to a query position, writing them into caller owned buffers
+    /// </summary>
+    /// <remarks>
+    /// Does not allocate once the buffers have grown to hold k neighbors
+    /// </remarks>
+    /// <param name="query"> position to find Neighbors to</param>
+    /// <param name="k"> the number of Neighbors to be found</param>
+    /// <param name="neighbors"> cleared and filled with the neighbors, nearest first</param>
+    /// <param name="heap"> scratch heap used by the search</param>
+    /// <param name="condition"> a condition a Neighbor must satisfy to be returned</param>
+    void FindNearestNeighbors(const Vec2& query, size_t k, std::vector<Obj*>& neighbors, MaxHeap& heap, const Condition& condition);
+
+    /// <summary>
+    /// A neighbor found by a query, with its squared distance to the query position
+    /// </summary>
+    struct Neighbor {
+        double squaredDist;
+        Obj* object;
+    };
+
+    /// <summary>
+    /// Finds the nearest Neighbors to a query position, writing them into a caller owned buffer of k neighbors
+    /// </summary>
+    /// <remarks>
+    /// The predicate is a template parameter so it is called directly, and the buffer is kept sorted by insertion,
+    /// which for the few neighbors an observation needs is cheaper than a heap
+    /// </remarks>
+    /// <param name="query"> position to find Neighbors to</param>
+    /// <param name="k"> the number of Neighbors to be found, the capacity of the buffer</param>
+    /// <param name="neighbors"> filled with the neighbors, nearest first</param>
+    /// <param name="predicate"> called as predicate(const Obj*), a Neighbor must satisfy it to be returned</param>
+    /// <returns>number of neighbors found, less than k if fewer objs satisfy the predicate</returns>
+    template<typename Predicate>
+    size_t FindNearestNeighbors(const Vec2& query, size_t k, Neighbor* neighbors, const Predicate& predicate) const;
+
+    /// <summary>
+    /// Adds a candidate to a buffer of neighbors sorted nearest first, dropping the farthest once the buffer holds k
+    /// </summary>
+    /// <param name="neighbors"> buffer of k neighbors</param>
+    /// <param name="count"> number of neighbors in the buffer, updated</param>
+    /// <param name="k"> capacity of the buffer</param>
+    static void InsertNeighbor(Neighbor* neighbors, size_t& count, size_t k, double squaredDist, Obj* object) {
+        if (count == k) {
+            if (!(squaredDist < neighbors[k - 1].squaredDist)) return;
+            count--;
+        }
+        size_t i = count;
+        while (i > 0 && squaredDist < neighbors[i - 1].squaredDist) {
+            neighbors[i] = neighbors[i - 1];
+            i--;
+        }
+        neighbors[i] = Neighbor{ squaredDist, object };
+        count++;
+    }
+
+    /// <summary>
+    /// A buffer of neighbors filled by a query that sorts the objs it finds into several buffers
+    /// </summary>
+    struct NeighborSet {
+        Neighbor* neighbors; // buffer of k neighbors, nearest first
+        size_t k; // capacity of the buffer
+        size_t count = 0; // number of neighbors found
+
+        /// <summary>
+        /// Gets the squared distance an obj must be under to enter the buffer
+        /// </summary>
+        double Bound() const { return count < k ? INFINITY : (k == 0 ? -INFINITY : neighbors[k - 1].squaredDist); }
+
+        /// <summary>
+        /// Gets the largest bound of some sets, an obj further away can not enter any of them
+        /// </summary>
+        static double Bound(const NeighborSet* sets, size_t setCount) {
+            double bound = -INFINITY;
+            for (size_t i = 0; i < setCount; i++) {
+                bound = std::max(bound, sets[i].Bound());
+            }
+            return bound;
+        }
+    };
+
+    /// <summary>
+    /// Finds the nearest Neighbors of several kinds in one search, each obj is sorted into the set classify picks for it
+    /// </summary>
+    /// <remarks>
+    /// One search visits each node once for all the sets, where a search per set would start again from the root.
+    /// The sets keep what they already hold, so searching several trees into the same sets finds the nearest of all of them
+    /// </remarks>
+    /// <param name="query"> position to find Neighbors to</param>
+    /// <param name="sets"> buffers to fill, start a search with their counts at 0</param>
+    /// <param name="setCount"> the number of sets</param>
+    /// <param name="classify"> called as classify(const Obj*), returns the index of the set an obj belongs to or setCount to leave it out</param>
+    /// <param name="wanted"> groups of the objs that may be found, subtrees holding none of them are skipped, see SetGroups</param>
+    template<typename Classify>
+    void FindNearestNeighbors(const Vec2& query, NeighborSet* sets, size_t setCount, const Classify& classify, uint64_t wanted = allGroups) const;
+
+    static constexpr uint64_t allGroups = ~uint64_t(0); // Every group, a search wanting these visits the whole tree
+
+    /// <summary>
+    /// Records which groups the objs of each subtree belong to, so searches can skip subtrees without the groups they want
+    /// </summary>
+    /// <remarks>
+    /// Groups are bits of a mask, an obj may belong to several. Several kinds of obj can share a bit,
+    /// the search then skips less but still checks every obj it finds. Build forgets the groups
+    /// </remarks>
+    /// <param name="groupOf"> called as groupOf(const Obj*), returns the groups of an obj</param>
+    template<typename GroupOf>
+    void SetGroups(const GroupOf& groupOf) {
+        groups.resize(entries.size());
+        SetGroups(Root(), groupOf);
+    }
+
     /// <summary>
     /// Finds all Neighbors within range of a query position
     /// </summary>
@@ -88,21 +207,54 @@ public:
     std::vector<Obj*> FindInRange(const Vec2& query, float range, Condition condition = [](const Obj* a) { return true; });
 
     /// <summary>
-    /// KDNode structure, used to build the KD tree
+    /// A subtree of the KD tree, the range of the point array it was built from
     /// </summary>
     struct KDNode {
-        Obj* point; // pointer to the node's obj
-        KDNode* left; // left child in the KD tree
-        KDNode* right; // right child in the KD tree
+        size_t begin; // first point of the subtree
+        size_t end; // one past the last point of the subtree
+
+        /// <summary>
+        /// Checks whether the subtree holds no points, the child of a leaf is empty
+        /// </summary>
+        bool Empty() const { return begin == end; }
+
+        /// <summary>
+        /// Gets the position of the node's point in the point array
+        /// </summary>
+        size_t Middle() const { return begin + (end - begin) / 2; }
 
         /// <summary>
-        /// KDNode constructor
+        /// Gets the left child, the points before the node's point
         /// </summary>
-        /// <param name="pt">pointer to obj</param>
-        KDNode(Obj*& pt) : point(pt), left(nullptr), right(nullptr) {}
+        KDNode Left() const { return KDNode{ begin, Middle() }; }
+
+        /// <summary>
+        /// Gets the right child, the points after the node's point
+        /// </summary>
+        KDNode Right() const { return KDNode{ Middle() + 1, end }; }
     };
 
-    KDNode* root; // root node, used to start a search and should point to the most central point
+    /// <summary>
+    /// Gets the root node, used to start a search, its point is the most central point
+    /// </summary>
+    KDNode Root() const { return KDNode{ 0, entries.size() }; }
+
+    /// <summary>
+    /// Gets the obj of a node
+    /// </summary>
+    /// <param name="node"> a node that is not empty</param>
+    Obj* Point(const KDNode& node) const { return entries[node.Middle()].object; }
+
+    /// <summary>
+    /// Gets the number of objs in the tree
+    /// </summary>
+    size_t Size() const { return entries.size(); }
+
+    /// <summary>
+    /// Gets an obj by its position in tree order, every subtree is a run of positions so a run of positions covers a compact area
+    /// </summary>
+    /// <param name="position"> position below Size</param>
+    Obj* At(size_t position) const { return entries[position].object; }
 
     /// <summary>
     /// Function for finding nearest neighbors
@@ -113,7 +265,34 @@ public:
     /// <param name="depth"> the depth of the search, used to determine the current axis </param>
     /// <param name="maxHeap"> heap containing the current known nearest neighbors to the query point</param>
     /// <param name="condition"> a condition a neighbor must satisfy to be returned</param>
-    void FindNearest(KDNode* node, const Vec2& query, size_t k, int depth, MaxHeap& maxHeap, Condition condition);
+    template<typename Predicate>
+    void FindNearest(KDNode node, const Vec2& query, size_t k, int depth, MaxHeap& maxHeap, const Predicate& condition) const;
+
+    /// <summary>
+    /// Function for finding nearest neighbors into a sorted buffer
+    /// </summary>
+    /// <param name="node"> the current node in the search</param>
+    /// <param name="query"> position to find neighbors to</param>
+    /// <param name="k"> the number of neighbors to be found</param>
+    /// <param name="depth"> the depth of the search, used to determine the current axis </param>
+    /// <param name="neighbors"> buffer containing the current known nearest neighbors to the query point, nearest first</param>
+    /// <param name="count"> number of neighbors in the buffer</param>
+    /// <param name="predicate"> a condition a neighbor must satisfy to be returned</param>
+    template<typename Predicate>
+    void FindNearest(KDNode node, const Vec2& query, size_t k, int depth, Neighbor* neighbors, size_t& count, const Predicate& predicate) const;
+
+    /// <summary>
+    /// Function for finding nearest neighbors into several sorted buffers at once
+    /// </summary>
+    /// <param name="node"> the current node in the search</param>
+    /// <param name="query"> position to find neighbors to</param>
+    /// <param name="depth"> the depth of the search, used to determine the current axis </param>
+    /// <param name="sets"> buffers containing the current known nearest neighbors of each kind</param>
+    /// <param name="setCount"> the number of sets</param>
+    /// <param name="classify"> picks the set of a neighbor</param>
+    /// <param name="wanted"> groups of the objs that may be found</param>
+    template<typename Classify>
+    void FindNearest(KDNode node, const Vec2& query, int depth, NeighborSet* sets, size_t setCount, const Classify& classify, uint64_t wanted) const;
     
     /// <summary>
     /// function for finding objs in range
@@ -122,75 +301,128 @@ public:
     /// <param name="query"> position to find objs in range of</param>
     /// <param name="range"> distance to search</param>
     /// <param name="depth"> the depth of the search, used to determine the current axis </param>
-    /// <param name="objects"> array of objects within range</param>
-    /// <param name="condition"> a condition a object must satisfy to be returned</param>
-    void FindRange(KDNode* node, const Vec2& query, float range, int depth, std::vector<Obj*>& objects, Condition condition);
+    /// <param name="objects"> array of objects within range, found objects are added to the end</param>
+    /// <param name="condition"> a condition a object must satisfy to be returned, called as condition(const Obj*)</param>
+    /// <param name="wanted"> groups of the objs that may be found, subtrees holding none of them are skipped, see SetGroups</param>
+    template<typename Predicate>
+    void FindRange(KDNode node, const Vec2& query, float range, int depth, std::vector<Obj*>& objects, const Predicate& condition, uint64_t wanted = allGroups) const;
 
     /// <summary>
-    /// Function to build KD tree
+    /// Function to build KD tree, replacing the previous tree
     /// </summary>
     /// <param name="points"> points to add to tree</param>
-    /// <param name="depth"> used to determine the current axis </param>
-    /// <returns>Created node, can be considered the root of "points"'s KD tree</returns>
-    KDNode* Build(std::vector<Obj*> points, int depth);
+    /// <param name="pool"> pool to partition large subtrees on as separate tasks, nullptr builds on the calling thread. The tree is the same either way</param>
+    void Build(const std::vector<Obj*>& points, ThreadPool* pool = nullptr) {
+        Build(points.data(), points.size(), pool);
+    }
 
     /// <summary>
-    /// clears and deletes the given node and its children (calling this on root will delete the whole tree)
+    /// Function to build KD tree from part of an array, replacing the previous tree
     /// </summary>
-    /// <param name="node"> node to delete</param>
-    void Clear(KDNode* node) {
-        if (node) {
-            Clear(node->left);
-            Clear(node->right);
-            delete node;
+    /// <param name="points"> first of the points to add to tree</param>
+    /// <param name="count"> number of points to add</param>
+    /// <param name="pool"> pool to partition large subtrees on as separate tasks, nullptr builds on the calling thread. The tree is the same either way</param>
+    void Build(Obj* const* points, size_t count, ThreadPool* pool = nullptr) {
+        entries.resize(count);
+        groups.clear();
+        for (size_t i = 0; i < count; i++) {
+            entries[i] = Entry{ points[i]->pos, points[i] };
         }
+        Partition(0, entries.size(), 0, pool);
+    }
+
+    /// <summary>
+    /// clears the whole tree, keeping the storage for the next build
+    /// </summary>
+    void Clear() {
+        entries.clear();
+        groups.clear();
     }
     private:
+    static constexpr size_t parallelPartitionSize = 4096; // Smallest subtree whose children are partitioned as separate tasks
 
-};
+    std::vector<Entry> entries; // points in tree order, see KDNode
+    std::vector<uint64_t> groups; // groups of the objs of each subtree, at the position of the subtree's point, empty unless SetGroups was called since the last Build
 
-template<Object Obj>
-typename KDTree<Obj>::KDNode* KDTree<Obj>::Build(std::vector<Obj*> points, int depth) {
-    if (points.empty()) return nullptr;
+    /// <summary>
+    /// Gets the groups of the objs of a subtree, every group if they were not set
+    /// </summary>
+    uint64_t SubtreeGroups(const KDNode& node) const { return groups.empty() ? allGroups : groups[node.Middle()]; }
 
-    size_t axis = depth % 2;
-    size_t median = points.size() / 2;
+    /// <summary>
+    /// Records the groups of a subtree and returns them
+    /// </summary>
+    template<typename GroupOf>
+    uint64_t SetGroups(KDNode node, const GroupOf& groupOf) {
+        if (node.Empty()) return 0;
+        uint64_t subtreeGroups = groupOf(Point(node)) | SetGroups(node.Left(), groupOf) | SetGroups(node.Right(), groupOf);
+        groups[node.Middle()] = subtreeGroups;
+        return subtreeGroups;
+    }
 
-    std::nth_element(points.begin(), points.begin() + median, points.end(), 
-        [axis](Obj*& a, Obj*& b) 
-        {
-            return axis == 0 ? a->pos.x < b->pos.x : a->pos.y < b->pos.y;
-        });
+    /// <summary>
+    /// Partitions a range into a subtree, the median on the axis of the depth goes to the middle
+    /// </summary>
+    /// <param name="begin"> first point of the range</param>
+    /// <param name="end"> one past the last point of the range</param>
+    /// <param name="depth"> used to determine the current axis </param>
+    /// <param name="pool"> pool to partition the children on, may be nullptr</param>
+    void Partition(size_t begin, size_t end, int depth, ThreadPool* pool);
+};
 
-    KDNode* node = new KDNode(points[median]);
-    std::vector<Obj*> leftPoints(points.begin(), points.begin() + median);
-    std::vector<Obj*> rightPoints(points.begin() + median + 1, points.end());
+template<Object Obj>
+void KDTree<Obj>::Partition(size_t begin, size_t end, int depth, ThreadPool* pool) {
+    if (begin == end) return;
 
-    node->left = Build(leftPoints, depth + 1);
-    node->right = Build(rightPoints, depth + 1);
+    size_t median = begin + (end - begin) / 2;
 
-    return node;
+    if (depth % 2 == 0) {
+        std::nth_element(entries.begin() + begin, entries.begin() + median, entries.begin() + end,
+            [](const Entry& a, const Entry& b) { return a.pos.x < b.pos.x; });
+    }
+    else {
+        std::nth_element(entries.begin() + begin, entries.begin() + median, entries.begin() + end,
+            [](const Entry& a, const Entry& b) { return a.pos.y < b.pos.y; });
+    }
+
+    // The children are disjoint ranges, so they can be partitioned at the same time
+    if (pool && end - begin >= parallelPartitionSize) {
+        pool->ParallelFor(2, 1, [this, begin, median, end, depth, pool](size_t first, size_t last) {
+            for (size_t child = first; child < last; child++) {
+                if (child == 0) Partition(begin, median, depth + 1, pool);
+                else Partition(median + 1, end, depth + 1, pool);
+            }
+        });
+    }
+    else {
+        Partition(begin, median, depth + 1, nullptr);
+        Partition(median + 1, end, depth + 1, nullptr);
+    }
 }
 
 template<Object Obj>
-void KDTree<Obj>::FindNearest(KDNode* node, const Vec2& query, size_t k, int depth, MaxHeap& maxHeap, Condition condition) {
-    if (!node) return;
+template<typename Predicate>
+void KDTree<Obj>::FindNearest(KDNode node, const Vec2& query, size_t k, int depth, MaxHeap& maxHeap, const Predicate& condition) const {
+    if (node.Empty()) return;
+    Obj* point = Point(node);
 
     // Calculate the squared distance from the query point to the current node's point
-    double dx = node->point->pos.x - query.x;
-    double dy = node->point->pos.y - query.y;
+    double dx = point->pos.x - query.x;
+    double dy = point->pos.y - query.y;
     double squaredDist = dx * dx + dy * dy;
 
     // If the point satisfies the condition
-    if (condition(node->point)) {
+    if (condition(point)) {
         if (maxHeap.size() < k) {
             // Add the point directly if heap is not full
-            maxHeap.emplace(squaredDist, node->point);
+            maxHeap.emplace_back(squaredDist, point);
+            std::push_heap(maxHeap.begin(), maxHeap.end(), CompareDist());
         }
-        else if (squaredDist < maxHeap.top().first) {
+        else if (squaredDist < maxHeap.front().first) {
             // Replace the farthest point if the current point is closer
-            maxHeap.pop();
-            maxHeap.emplace(squaredDist, node->point);
+            std::pop_heap(maxHeap.begin(), maxHeap.end(), CompareDist());
+            maxHeap.back() = { squaredDist, point };
+            std::push_heap(maxHeap.begin(), maxHeap.end(), CompareDist());
         }
     }
 
@@ -198,72 +430,172 @@ void KDTree<Obj>::FindNearest(KDNode* node, const Vec2& query, size_t k, int dep
     size_t axis = depth % 2;
 
     // Determine which branch to explore next based on the query point's coordinate and the current node's coordinate
-    bool goLeft = (axis == 0 ? query.x < node->point->pos.x : query.y < node->point->pos.y);
-    KDNode* nextBranch = goLeft ? node->left : node->right;
-    KDNode* otherBranch = goLeft ? node->right : node->left;
+    bool goLeft = (axis == 0 ? query.x < point->pos.x : query.y < point->pos.y);
+    KDNode nextBranch = goLeft ? node.Left() : node.Right();
+    KDNode otherBranch = goLeft ? node.Right() : node.Left();
 
     // Recursively search the next branch
     FindNearest(nextBranch, query, k, depth + 1, maxHeap, condition);
 
     // Calculate the squared distance to the splitting plane (axis distance)
-    double axisDist = (axis == 0 ? query.x - node->point->pos.x : query.y - node->point->pos.y);
+    double axisDist = (axis == 0 ? query.x - point->pos.x : query.y - point->pos.y);
     double axisDistSq = axisDist * axisDist;
 
     // If the heap has less than k elements or the distance to the splitting plane is less than the farthest distance in the heap, search the other branch too
-    if (maxHeap.size() < k || axisDistSq < maxHeap.top().first) {
+    if (maxHeap.size() < k || axisDistSq < maxHeap.front().first) {
         FindNearest(otherBranch, query, k, depth + 1, maxHeap, condition);
     }
 }
 
-template <Object Obj>
-void KDTree<Obj>::FindRange(KDNode* node, const Vec2& query, float range, int depth, std::vector<Obj*>& objects, Condition condition) {
-    if (!node) return;
+template<Object Obj>
+template<typename Predicate>
+void KDTree<Obj>::FindNearest(KDNode node, const Vec2& query, size_t k, int depth, Neighbor* neighbors, size_t& count, const Predicate& predicate) const {
+    if (node.Empty()) return;
+    Obj* point = Point(node);
 
-    // Calculate distance from the query point to the current node's point
-    double dist = (node->point->pos - query).Length();
+    // Calculate the squared distance from the query point to the current node's point
+    double dx = point->pos.x - query.x;
+    double dy = point->pos.y - query.y;
+    double squaredDist = dx * dx + dy * dy;
+
+    // Only points that would make it into the buffer are tested against the predicate
+    if ((count < k || squaredDist < neighbors[k - 1].squaredDist) && predicate(point)) {
+        InsertNeighbor(neighbors, count, k, squaredDist, point);
+    }
+
+    // Determine the current axis (0 for x, 1 for y)
+    size_t axis = depth % 2;
+
+    // Determine which branch to explore next based on the query point's coordinate and the current node's coordinate
+    bool goLeft = (axis == 0 ? query.x < point->pos.x : query.y < point->pos.y);
+    KDNode nextBranch = goLeft ? node.Left() : node.Right();
+    KDNode otherBranch = goLeft ? node.Right() : node.Left();
+
+    // Recursively search the next branch
+    FindNearest(nextBranch, query, k, depth + 1, neighbors, count, predicate);
+
+    // Calculate the squared distance to the splitting plane (axis distance)
+    double axisDist = (axis == 0 ? query.x - point->pos.x : query.y - point->pos.y);
+    double axisDistSq = axisDist * axisDist;
+
+    // If the buffer has less than k elements or the distance to the splitting plane is less than the farthest distance in it, search the other branch too
+    if (count < k || axisDistSq < neighbors[k - 1].squaredDist) {
+        FindNearest(otherBranch, query, k, depth + 1, neighbors, count, predicate);
+    }
+}
+
+template<Object Obj>
+template<typename Classify>
+void KDTree<Obj>::FindNearest(KDNode node, const Vec2& query, int depth, NeighborSet* sets, size_t setCount, const Classify& classify, uint64_t wanted) const {
+    if (node.Empty() || !(SubtreeGroups(node) & wanted)) return;
+    Obj* point = Point(node);
+
+    // Calculate the squared distance from the query point to the current node's point
+    double dx = point->pos.x - query.x;
+    double dy = point->pos.y - query.y;
+    double squaredDist = dx * dx + dy * dy;
+
+    // Only points that could make it into one of the buffers are classified
+    if (squaredDist < NeighborSet::Bound(sets, setCount)) {
+        size_t set = classify(point);
+        if (set < setCount && sets[set].k > 0) {
+            InsertNeighbor(sets[set].neighbors, sets[set].count, sets[set].k, squaredDist, point);
+        }
+    }
+
+    // Determine the current axis (0 for x, 1 for y)
+    size_t axis = depth % 2;
+
+    // Determine which branch to explore next based on the query point's coordinate and the current node's coordinate
+    bool goLeft = (axis == 0 ? query.x < point->pos.x : query.y < point->pos.y);
+    KDNode nextBranch = goLeft ? node.Left() : node.Right();
+    KDNode otherBranch = goLeft ? node.Right() : node.Left();
+
+    // Recursively search the next branch
+    FindNearest(nextBranch, query, depth + 1, sets, setCount, classify, wanted);
+
+    // The other branch is searched if any buffer could still take a point beyond the splitting plane
+    double axisDist = (axis == 0 ? query.x - point->pos.x : query.y - point->pos.y);
+    if (axisDist * axisDist < NeighborSet::Bound(sets, setCount)) {
+        FindNearest(otherBranch, query, depth + 1, sets, setCount, classify, wanted);
+    }
+}
+
+template<Object Obj>
+template<typename Predicate>
+void KDTree<Obj>::FindRange(KDNode node, const Vec2& query, float range, int depth, std::vector<Obj*>& objects, const Predicate& condition, uint64_t wanted) const {
+    if (node.Empty() || !(SubtreeGroups(node) & wanted)) return;
+    Obj* point = Point(node);
+
+    // Calculate the squared distance from the query point to the current node's point, compared to the squared range to skip the square root
+    float dx = point->pos.x - query.x;
+    float dy = point->pos.y - query.y;
 
     // If the point is within the range and meets the condition, add it to the result vector
-    if (dist < range && condition(node->point)) {
-        objects.push_back(node->point);
+    if (dx * dx + dy * dy < range * range && condition(point)) {
+        objects.push_back(point);
     }
 
     // Determine the axis (0 for x, 1 for y)
     size_t axis = depth % 2;
 
     // Determine which branch to search next
-    KDNode* nextBranch = (axis == 0 ? query.x < node->point->pos.x : query.y < node->point->pos.y) ? node->left : node->right;
-    KDNode* otherBranch = (axis == 0 ? query.x < node->point->pos.x : query.y < node->point->pos.y) ? node->right : node->left;
+    KDNode nextBranch = (axis == 0 ? query.x < point->pos.x : query.y < point->pos.y) ? node.Left() : node.Right();
+    KDNode otherBranch = (axis == 0 ? query.x < point->pos.x : query.y < point->pos.y) ? node.Right() : node.Left();
 
     // Recursively search the next branch
-    FindRange(nextBranch, query, range, depth + 1, objects, condition);
+    FindRange(nextBranch, query, range, depth + 1, objects, condition, wanted);
 
     // Determine the distance to the splitting plane
-    double axisDist = (axis == 0 ? std::abs(query.x - node->point->pos.x) : std::abs(query.y - node->point->pos.y));
+    double axisDist = (axis == 0 ? std::abs(query.x - point->pos.x) : std::abs(query.y - point->pos.y));
 
     // If the distance to the splitting plane is less than the range search the other branch too.
     if (axisDist < range) {
-        FindRange(otherBranch, query, range, depth + 1, objects, condition);
+        FindRange(otherBranch, query, range, depth + 1, objects, condition, wanted);
     }
 }
 
 template<Object Obj>
 std::vector<Obj*> KDTree<Obj>::FindNearestNeighbors(const Vec2& query, size_t k, Condition condition) {
     MaxHeap maxHeap;
-    FindNearest(root, query, k, 0, maxHeap, condition);
     std::vector<Obj*> neighbors;
-    while (!maxHeap.empty()) {
-        neighbors.push_back(maxHeap.top().second);
-        maxHeap.pop();
+    FindNearestNeighbors(query, k, neighbors, maxHeap, condition);
+    return neighbors;
+}
+
+template<Object Obj>
+void KDTree<Obj>::FindNearestNeighbors(const Vec2& query, size_t k, std::vector<Obj*>& neighbors, MaxHeap& maxHeap, const Condition& condition) {
+    maxHeap.clear();
+    neighbors.clear();
+    if (k == 0) return;
+    FindNearest(Root(), query, k, 0, maxHeap, condition);
+
+    // Sorting the heap leaves the nearest neighbor first
+    std::sort_heap(maxHeap.begin(), maxHeap.end(), CompareDist());
+    for (const std::pair<double, Obj*>& neighbor : maxHeap) {
+        neighbors.push_back(neighbor.second);
     }
+}
 
-    std::reverse(neighbors.begin(), neighbors.end());
-    return neighbors;
+template<Object Obj>
+template<typename Predicate>
+size_t KDTree<Obj>::FindNearestNeighbors(const Vec2& query, size_t k, Neighbor* neighbors, const Predicate& predicate) const {
+    size_t count = 0;
+    if (k == 0) return 0;
+    FindNearest(Root(), query, k, 0, neighbors, count, predicate);
+    return count;
+}
+
+template<Object Obj>
+template<typename Classify>
+void KDTree<Obj>::FindNearestNeighbors(const Vec2& query, NeighborSet* sets, size_t setCount, const Classify& classify, uint64_t wanted) const {
+    FindNearest(Root(), query, 0, sets, setCount, classify, wanted);
 }
 
 template<Object Obj>
 inline std::vector<Obj*> KDTree<Obj>::FindInRange(const Vec2& query, float range, Condition condition)
 {
     std::vector<Obj*> objects;
-    FindRange(root, query, range, 0, objects, condition);
+    FindRange(Root(), query, range, 0, objects, condition);
     return objects;
 }
@@ -0,0 +1,67 @@
+#include "NetworkArena.h"
+#include <algorithm>
+
+NetworkArena::~NetworkArena()
+{
+	for (void* chunk : chunks)
+	{
+		::operator delete(chunk);
+	}
+}
+
+void* NetworkArena::Allocate(size_t size)
+{
+	size = (std::max(size, sizeof(FreeBlock)) + alignment - 1) & ~(alignment - 1);
+	const size_t sizeClass = size / alignment - 1;
+	liveBytes += size;
+	if (sizeClass < sizeClassCount && freeLists[sizeClass])
+	{
+		FreeBlock* block = freeLists[sizeClass];
+		freeLists[sizeClass] = block->next;
+		return block;
+	}
+
+	if (static_cast<size_t>(chunkEnd - cursor) < size)
+	{
+		AddChunk(size);
+	}
+	void* block = cursor;
+	cursor += size;
+	return block;
+}
+
+void NetworkArena::Free(void* ptr, size_t size)
+{
+	size = (std::max(size, sizeof(FreeBlock)) + alignment - 1) & ~(alignment - 1);
+	const size_t sizeClass = size / alignment - 1;
+	if (ptr)
+	{
+		liveBytes -= size;
+	}
+	if (ptr && sizeClass < sizeClassCount)
+	{
+		FreeBlock* block = static_cast<FreeBlock*>(ptr);
+		block->next = freeLists[sizeClass];
+		freeLists[sizeClass] = block;
+	}
+}
+
+void NetworkArena::Reserve(size_t size)
+{
+	size = (size + alignment - 1) & ~(alignment - 1);
+	if (static_cast<size_t>(chunkEnd - cursor) < size)
+	{
+		AddChunk(size);
+	}
+}
+
+void NetworkArena::AddChunk(size_t size)
+{
+	// The rest of the current chunk is abandoned, it is smaller than the block being allocated
+	const size_t chunkSize = std::max(size, nextChunkSize);
+	nextChunkSize = std::min(nextChunkSize * 2, maxChunkSize);
+	chunks.push_back(::operator new(chunkSize));
+	reservedBytes += chunkSize;
+	cursor = static_cast<char*>(chunks.back());
+	chunkEnd = cursor + chunkSize;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <new>
+
+/// <summary>
+/// Memory owned by one neural network, its layers, nodes, synapses and their lists are allocated from it.
+/// </summary>
+/// <remarks>
+/// Blocks are handed out from large chunks, so objects created together (a whole copied network for example) sit next to each other.
+/// Freed blocks are kept on a free list per size class and reused by later allocations of the same size.
+/// All chunks are released at once when the arena is destroyed, nothing allocated from it may be used after that.
+/// Not thread safe, a network is only modified by one thread at a time.
+/// </remarks>
+class NetworkArena
+{
+public:
+	NetworkArena() {}
+
+	/// <summary>
+	/// Releases every chunk of the arena
+	/// </summary>
+	~NetworkArena();
+
+	NetworkArena(const NetworkArena&) = delete;
+	NetworkArena& operator=(const NetworkArena&) = delete;
+
+	/// <summary>
+	/// Allocates a block of memory aligned to NetworkArena::alignment
+	/// </summary>
+	/// <param name="size"> size of the block in bytes</param>
+	/// <returns>Pointer to the block</returns>
+	void* Allocate(size_t size);
+
+	/// <summary>
+	/// Returns a block to the arena so it can be reused
+	/// </summary>
+	/// <param name="ptr"> block returned by Allocate</param>
+	/// <param name="size"> size the block was allocated with</param>
+	void Free(void* ptr, size_t size);
+
+	/// <summary>
+	/// Makes sure the current chunk can hold size more bytes, so the next allocations up to that size sit in one chunk
+	/// </summary>
+	/// <param name="size"> number of bytes</param>
+	void Reserve(size_t size);
+
+	/// <summary>
+	/// Gets the number of bytes the arena has reserved from the heap
+	/// </summary>
+	size_t GetReservedBytes() const { return reservedBytes; }
+
+	/// <summary>
+	/// Gets the number of bytes in blocks that are currently allocated
+	/// </summary>
+	size_t GetLiveBytes() const { return liveBytes; }
+
+	static constexpr size_t alignment = 16; // Alignment of every block
+
+private:
+	static constexpr size_t sizeClassCount = 16; // Blocks up to sizeClassCount * alignment bytes are reused through the free lists, larger ones only return with the arena
+	static constexpr size_t firstChunkSize = 4096; // Size of the first chunk, later chunks double in size
+	static constexpr size_t maxChunkSize = 1 << 20; // Largest chunk size the doubling grows to
+
+	static_assert(__STDCPP_DEFAULT_NEW_ALIGNMENT__ >= alignment, "chunks are allocated with the default operator new");
+
+	/// <summary>
+	/// A freed block, linked into the free list of its size class
+	/// </summary>
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	std::vector<void*> chunks; // Every chunk reserved from the heap
+	char* cursor = nullptr; // Next unused byte of the current chunk
+	char* chunkEnd = nullptr; // End of the current chunk
+	size_t nextChunkSize = firstChunkSize; // Size of the next chunk to reserve
+	size_t reservedBytes = 0; // Total size of all chunks
+	size_t liveBytes = 0; // Total size of all blocks that have not been freed
+	FreeBlock* freeLists[sizeClassCount] = {}; // Freed blocks of each size class
+
+	/// <summary>
+	/// Reserves a new chunk from the heap that can hold at least size bytes
+	/// </summary>
+	void AddChunk(size_t size);
+};
+
+/// <summary>
+/// Standard allocator that allocates from a NetworkArena, or from the heap when it has no arena
+/// </summary>
+/// <typeparam name="T"> type of the allocated values</typeparam>
+template<typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	ArenaAllocator() {}
+	ArenaAllocator(NetworkArena* arena) : arena(arena) {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count)
+	{
+		if (arena)
+		{
+			return static_cast<T*>(arena->Allocate(count * sizeof(T)));
+		}
+		return static_cast<T*>(::operator new(count * sizeof(T)));
+	}
+
+	void deallocate(T* ptr, size_t count)
+	{
+		if (arena)
+		{
+			arena->Free(ptr, count * sizeof(T));
+		}
+		else
+		{
+			::operator delete(ptr);
+		}
+	}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+	NetworkArena* arena = nullptr; // Arena to allocate from, nullptr to use the heap
+};
@@ -1,5 +1,5 @@
 #include "NeuralNetwork.h"
-#include <queue>
+#include "CompiledNetwork.h"
 #include <unordered_map>
 #include <fstream>
 
@@ -7,47 +7,80 @@ NeuralNetwork::NeuralNetwork(std::vector<ActivationFunction*>& functions) : func
 {
 	for (size_t i = 0; i < 2; i++)
 	{
-		new Layer(this);
+		new (this) Layer(this);
 	}
 }
 
 NeuralNetwork::~NeuralNetwork()
 {
-	while (!layers.empty())
-	{
-		delete layers.front();
-		pop_front();
-	}
+	// Layers, nodes and synapses only own memory from the arena, so they are released with it instead of being deleted one by one
+	InvalidatePlan();
 }
 
 void NeuralNetwork::AddInput(Node* newNode)
 {
 	inputNodes.push_back(newNode);
 	newNode->SetLayer(layers.front());
+	InvalidatePlan();
 }
 
 void NeuralNetwork::AddOutput(Node* newNode)
 {
 	outputNodes.push_back(newNode);
 	newNode->SetLayer(layers.back());
+	InvalidatePlan();
+}
+
+std::vector<double> NeuralNetwork::Evaluate(const std::vector<double>& inputValues)
+{
+	std::vector<double> outputValues(GetPlan()->OutputCount());
+	Evaluate(inputValues.data(), inputValues.size(), outputValues.data(), outputValues.size());
+	return outputValues;
 }
 
-std::vector<double> NeuralNetwork::Evaluate(std::vector<double> inputValues)
+void NeuralNetwork::Evaluate(const double* inputValues, size_t inputCount, double* outputValues, size_t outputCount)
 {
-	for (size_t i = 0; i < inputValues.size() && i < inputNodes.size(); i++)
+	GetPlan()->Evaluate(inputValues, inputCount, outputValues, outputCount);
+}
+
+CompiledNetwork* NeuralNetwork::GetPlan()
+{
+	if (!plan)
 	{
-		inputNodes[i]->inputValue += inputValues[i];
+		plan = new CompiledNetwork(*this);
 	}
+	return plan;
+}
 
-	Update();
+void NeuralNetwork::InvalidatePlan()
+{
+	if (plan)
+	{
+		delete plan;
+		plan = nullptr;
+	}
+}
 
-	std::vector<double> outputValues(outputNodes.size());
-	for (size_t i = 0; i < outputNodes.size(); i++)
+void NeuralNetwork::SyncNodeOutputs()
+{
+	if (!plan) return;
+	size_t n = 0;
+	for (Layer* layer : layers)
 	{
-		outputValues[i] = outputNodes[i]->outputValue;
+		for (Node* node : *layer)
+		{
+			node->outputValue = plan->Value(n++);
+		}
 	}
+}
 
-	return outputValues;
+void NeuralNetwork::SetPrecision(Precision newPrecision)
+{
+	if (precision != newPrecision)
+	{
+		precision = newPrecision;
+		InvalidatePlan();
+	}
 }
 
 void NeuralNetwork::Update()
@@ -70,73 +103,58 @@ void NeuralNetwork::MakeFullyConnected()
 		{
 			for (Node* nodeB : **std::next(layerIter))
 			{
-				new Synapse(nodeA, nodeB, 1);
+				new (this) Synapse(nodeA, nodeB, 1);
 			}
 		}
 		layerIter++;
 	}
 }
 
-void CombineDuplicateSynapses(std::list<Synapse*>& synapses)
+void NeuralNetwork::CombineDuplicateSynapses(Node* node)
 {
-	std::list<Synapse*>::iterator synapseIterA = synapses.begin();
-	while (synapseIterA != synapses.end())
+	for (Synapse* synapse : node->outputs)
 	{
-		std::list<Synapse*>::iterator synapseIterB = std::next(synapseIterA);
-		while (synapseIterB != synapses.end())
+		synapse->out->mergeSynapse = nullptr;
+	}
+
+	SynapseList::iterator synapseIter = node->outputs.begin();
+	while (synapseIter != node->outputs.end())
+	{
+		Synapse* synapse = *synapseIter;
+		synapseIter++;
+		Synapse*& first = synapse->out->mergeSynapse;
+		if (!first)
 		{
-			if (((*synapseIterA)->in == (*synapseIterB)->in) && ((*synapseIterA)->out == (*synapseIterB)->out))
-			{
-				(*synapseIterA)->weight += (*synapseIterB)->weight;
-				Synapse* extraSynapse = (*synapseIterB);
-				synapseIterB++;
-				delete extraSynapse;
-				continue;
-			}
-			synapseIterB++;
+			first = synapse;
+			continue;
 		}
-		synapseIterA++;
+		first->SetWeight(first->weight + synapse->weight);
+		delete synapse;
 	}
 }
 
 void NeuralNetwork::CleanSynapses()
 {
-	iterator layerIter = layers.begin();
-	while (layerIter != std::prev(layers.end()))
+	// Removing a synapse marks its target, so nodes may be appended while this runs
+	for (size_t i = 0; i < dirtyNodes.size(); i++)
 	{
-		Layer::iterator nodeIter = (*layerIter)->begin();
-		// Iterate through nodes
-		while (nodeIter != (*layerIter)->end())
-		{
-			CombineDuplicateSynapses((*nodeIter)->outputs);
-			nodeIter++;
-		}
-		layerIter++;
+		CombineDuplicateSynapses(dirtyNodes[i]);
 	}
 }
 
 void NeuralNetwork::CleanNodes()
 {
-	iterator layerIter = std::next(layers.begin());
-	std::queue<Node*> deleteQueue;
-	while (layerIter != std::prev(layers.end()))
+	std::vector<Node*> deleteQueue;
+	for (Node* node : dirtyNodes)
 	{
-		Layer::iterator nodeIter = (*layerIter)->begin();
-		// Iterate through nodes
-		while (nodeIter != (*layerIter)->end())
+		if (node->GetLayer() != layers.front() && node->GetLayer() != layers.back() && node->inputs.empty() && node->outputs.empty())
 		{
-			if ((*nodeIter)->inputs.empty() && (*nodeIter)->outputs.empty())
-			{
-				deleteQueue.push(*nodeIter);
-			}
-			nodeIter++;
+			deleteQueue.push_back(node);
 		}
-		layerIter++;
 	}
-	while (!deleteQueue.empty())
+	for (Node* node : deleteQueue)
 	{
-		deleteQueue.front()->Delete();
-		deleteQueue.pop();
+		node->Delete();
 	}
 }
 
@@ -144,12 +162,21 @@ void NeuralNetwork::Clean()
 {
 	CleanNodes();
 	CleanSynapses();
+	for (Node* node : dirtyNodes)
+	{
+		node->dirtyIndex = Node::notDirty;
+	}
+	dirtyNodes.clear();
 }
 
 std::vector<char> NeuralNetwork::GetBin(const NeuralNetwork& network)
 {
 	std::vector<char> data;
 
+	// Saving the file header and the precision the biases and weights are stored in
+	AppendToData(data, fileMagic);
+	AppendToData(data, network.precision);
+
 	// Saving the number of functions
 	AppendToData(data, network.functions.size());
 
@@ -180,12 +207,12 @@ std::vector<char> NeuralNetwork::GetBin(const NeuralNetwork& network)
 	for (Layer* layer : network) {
 		for (Node* node : *layer) {
 			AppendToData(data, funcMap[node->function]);
-			AppendToData(data, node->bias);
+			AppendParameter(data, node->bias, network.precision);
 			AppendToData(data, node->outputs.size());
 
 			for (Synapse* synapse : node->outputs) {
 				AppendToData(data, nodeMap[synapse->out]);
-				AppendToData(data, synapse->weight);
+				AppendParameter(data, synapse->weight, network.precision);
 			}
 		}
 	}
@@ -209,6 +236,24 @@ NeuralNetwork* NeuralNetwork::MakeFromBin(std::vector<char>& data, std::vector<A
 		functionMap[function->name] = function;
 	}
 
+	// Files with a header record their precision, older files start with the function count and hold doubles
+	Precision precision = Precision::Float64;
+	size_t headerOffset = offset;
+	uint64_t magic = 0;
+	if (data.size() >= offset + sizeof(magic) + sizeof(precision))
+	{
+		ExtractFromData(data, headerOffset, magic);
+	}
+	if (magic == fileMagic)
+	{
+		ExtractFromData(data, headerOffset, precision);
+		if (precision != Precision::Float64 && precision != Precision::Float32)
+		{
+			return nullptr;
+		}
+		offset = headerOffset;
+	}
+
 	// Loading the number of functions
 	size_t numFuncs;
 	ExtractFromData(data, offset, numFuncs);
@@ -238,10 +283,12 @@ NeuralNetwork* NeuralNetwork::MakeFromBin(std::vector<char>& data, std::vector<A
 		nodeCount += layerSizes[i];
 	}
 
+	NeuralNetwork* network = new NeuralNetwork(avalableFunctions);
+	network->precision = precision;
 	std::vector<Node*> nodes;
 	for (size_t i = 0; i < nodeCount; i++)
 	{
-		nodes.push_back(new Node(nullptr, nullptr));
+		nodes.push_back(new (network) Node(nullptr, nullptr));
 	}
 
 	// Loading nodes
@@ -249,7 +296,7 @@ NeuralNetwork* NeuralNetwork::MakeFromBin(std::vector<char>& data, std::vector<A
 		size_t funcIndex;
 		double bias;
 		ExtractFromData(data, offset, funcIndex);
-		ExtractFromData(data, offset, bias);
+		ExtractParameter(data, offset, bias, precision);
 		nodes[i]->function = (loadedFunctions)[funcIndex];
 		nodes[i]->bias = bias;
 		size_t synapseCount;
@@ -258,13 +305,12 @@ NeuralNetwork* NeuralNetwork::MakeFromBin(std::vector<char>& data, std::vector<A
 			size_t outIndex;
 			double weight;
 			ExtractFromData(data, offset, outIndex);
-			ExtractFromData(data, offset, weight);
-			new Synapse(nodes[i], nodes[outIndex], weight);
+			ExtractParameter(data, offset, weight, precision);
+			new (network) Synapse(nodes[i], nodes[outIndex], weight);
 		}
 	}
 
 	// Reconstructing the network
-	NeuralNetwork* network = new NeuralNetwork(avalableFunctions);
 	size_t n = 0;
 	for (size_t i = 0; i < layerSizes.front(); i++)
 	{
@@ -272,7 +318,7 @@ NeuralNetwork* NeuralNetwork::MakeFromBin(std::vector<char>& data, std::vector<A
 	}
 
 	for (size_t i = 1; i < numLayers - 1; ++i) {
-		Layer* layer = new Layer(network, std::prev(network->end()));
+		Layer* layer = new (network) Layer(network, std::prev(network->end()));
 		for (size_t j = 0; j < layerSizes[i]; ++j) {
 			nodes[n++]->SetLayer(layer);
 		}
@@ -325,77 +371,117 @@ void NeuralNetwork::Delete()
 
 NeuralNetwork* NeuralNetwork::Copy(NeuralNetwork* oldNetwork)
 {
+	// The plan numbers every node densely in layer order, the copy is built by index instead of mapping node pointers
+	const CompiledNetwork* oldPlan = oldNetwork->GetPlan();
+
 	NeuralNetwork* newNetwork = new NeuralNetwork(oldNetwork->functions);
-	std::unordered_map<Node*, Node*> nodeMap;
+	newNetwork->precision = oldNetwork->precision;
+	newNetwork->arena.Reserve(oldNetwork->arena.GetLiveBytes());
+	newNetwork->synapses.reserve(oldNetwork->synapses.size());
 	while (newNetwork->size() < oldNetwork->size())
 	{
-		new Layer(newNetwork);
+		new (newNetwork) Layer(newNetwork);
 	}
 
+	std::vector<Node*> newNodes(oldPlan->NodeCount());
 	{
-		iterator oldLayerIter = oldNetwork->begin();
 		iterator newLayerIter = newNetwork->begin();
-		while (oldLayerIter != oldNetwork->end() && newLayerIter != newNetwork->end())
+		for (const Layer* oldLayer : *oldNetwork)
 		{
-			Layer::iterator oldNodeIter = (*oldLayerIter)->begin();
-			while (oldNodeIter != (*oldLayerIter)->end())
+			for (const Node* oldNode : *oldLayer)
 			{
-				Node* newNode = new Node(*newLayerIter, (*oldNodeIter)->function, (*oldNodeIter)->bias);
-				nodeMap.insert({ (*oldNodeIter),newNode });
-				oldNodeIter++;
+				Node* newNode = new (newNetwork) Node(*newLayerIter, oldNode->function, oldNode->bias);
+				newNode->planIndex = oldNode->planIndex;
+				newNodes[oldNode->planIndex] = newNode;
 			}
-			oldLayerIter++;
 			newLayerIter++;
 		}
 	}
 
+	for (const Layer* oldLayer : *oldNetwork)
 	{
-		iterator oldLayerIter = oldNetwork->begin();
-		iterator newLayerIter = newNetwork->begin();
-		while (oldLayerIter != oldNetwork->end() && newLayerIter != newNetwork->end())
+		for (const Node* oldNode : *oldLayer)
 		{
-			Layer::iterator oldNodeIter = (*oldLayerIter)->begin();
-			Layer::iterator newNodeIter = (*newLayerIter)->begin();
-			while (oldNodeIter != (*oldLayerIter)->end() && newNodeIter != (*newLayerIter)->end())
+			Node* newNode = newNodes[oldNode->planIndex];
+			for (const Synapse* synapse : oldNode->outputs)
 			{
-				for (Synapse* synapse : (*oldNodeIter)->outputs)
-				{
-					new Synapse(*newNodeIter, nodeMap[synapse->out], synapse->weight);
-				}
-				oldNodeIter++;
-				newNodeIter++;
+				Synapse* newSynapse = new (newNetwork) Synapse(newNode, newNodes[synapse->out->planIndex], synapse->weight);
+				newSynapse->planIndex = synapse->planIndex;
 			}
-			oldLayerIter++;
-			newLayerIter++;
 		}
 	}
-	newNetwork->inputNodes.resize(oldNetwork->inputNodes.size());
 
+	newNetwork->inputNodes.resize(oldNetwork->inputNodes.size());
 	for (size_t i = 0; i < oldNetwork->inputNodes.size(); i++)
 	{
-		newNetwork->inputNodes[i] = nodeMap[oldNetwork->inputNodes[i]];
+		newNetwork->inputNodes[i] = newNodes[oldNetwork->inputNodes[i]->planIndex];
 	}
 
 	newNetwork->outputNodes.resize(oldNetwork->outputNodes.size());
-
 	for (size_t i = 0; i < oldNetwork->outputNodes.size(); i++)
 	{
-		newNetwork->outputNodes[i] = nodeMap[oldNetwork->outputNodes[i]];
+		newNetwork->outputNodes[i] = newNodes[oldNetwork->outputNodes[i]->planIndex];
+	}
+
+	// Only the nodes the parent has not cleaned yet need cleaning in the copy
+	for (Node* node : newNetwork->dirtyNodes)
+	{
+		node->dirtyIndex = Node::notDirty;
+	}
+	newNetwork->dirtyNodes.clear();
+	for (Node* node : oldNetwork->dirtyNodes)
+	{
+		newNodes[node->planIndex]->MarkDirty();
 	}
 
-	newNetwork->Update();
+	// The copy has the same topology and parameters, so it forks the parent's plan instead of compiling its own.
+	// The plan indices copied above keep bias and weight changes on the copy pointing at the right entries.
+	newNetwork->InvalidatePlan();
+	newNetwork->plan = new CompiledNetwork(*oldPlan);
 
 	return newNetwork;
 }
 
-Layer::Layer(NeuralNetwork* neuralNetwork) : neuralNetwork(neuralNetwork)
+void* NetworkObject::operator new(size_t size, NeuralNetwork* network)
 {
-	neuralNetwork->push_back(this);
+	// The network is stored in front of the object so a plain delete can find its arena again
+	char* block = static_cast<char*>(network->arena.Allocate(headerSize + size));
+	new (block) Header{ network, size };
+	return block + headerSize;
 }
 
-Layer::Layer(NeuralNetwork* neuralNetwork, std::list<Layer*>::const_iterator pos) : neuralNetwork(neuralNetwork)
+void NetworkObject::operator delete(void* ptr, NeuralNetwork* network)
 {
-	neuralNetwork->insert(pos, this);
+	char* block = static_cast<char*>(ptr) - headerSize;
+	network->arena.Free(block, headerSize + reinterpret_cast<Header*>(block)->size);
+}
+
+void NetworkObject::operator delete(void* ptr, size_t size)
+{
+	if (ptr)
+	{
+		GetArena(ptr)->Free(static_cast<char*>(ptr) - headerSize, headerSize + size);
+	}
+}
+
+NeuralNetwork* NetworkObject::GetOwner(const void* object)
+{
+	return *reinterpret_cast<NeuralNetwork* const*>(static_cast<const char*>(object) - headerSize);
+}
+
+NetworkArena* NetworkObject::GetArena(const void* object)
+{
+	return &GetOwner(object)->arena;
+}
+
+Layer::Layer(NeuralNetwork* neuralNetwork) : nodes(GetArena(this)), nodeIndex(GetArena(this)), neuralNetwork(neuralNetwork)
+{
+	networkHook = neuralNetwork->insert(neuralNetwork->end(), this);
+}
+
+Layer::Layer(NeuralNetwork* neuralNetwork, std::list<Layer*>::const_iterator pos) : nodes(GetArena(this)), nodeIndex(GetArena(this)), neuralNetwork(neuralNetwork)
+{
+	networkHook = neuralNetwork->insert(pos, this);
 }
 
 Layer::~Layer()
@@ -417,16 +503,16 @@ void Layer::DeleteIfEmpty()
 
 void Layer::Delete()
 {
-	neuralNetwork->remove(this);
+	neuralNetwork->erase(networkHook);
 	delete this;
 }
 
-Node::Node(Layer* layer, ActivationFunction* function) : function(function)
+Node::Node(Layer* layer, ActivationFunction* function) : function(function), inputs(GetArena(this)), outputs(GetArena(this))
 {
 	SetLayer(layer);
 }
 
-Node::Node(Layer* layer, ActivationFunction* function, double bias) : function(function), bias(bias)
+Node::Node(Layer* layer, ActivationFunction* function, double bias) : function(function), bias(bias), inputs(GetArena(this)), outputs(GetArena(this))
 {
 	SetLayer(layer);
 }
@@ -434,6 +520,7 @@ Node::Node(Layer* layer, ActivationFunction* function, double bias) : function(f
 Node::~Node()
 {
 	ClearSynapses();
+	ClearDirty();
 }
 
 void Node::Update()
@@ -448,16 +535,68 @@ void Node::Update()
 	inputValue = bias;
 }
 
+void Node::SetBias(double newBias)
+{
+	bias = newBias;
+	if (CompiledNetwork* plan = layer ? layer->GetNetwork()->GetCurrentPlan() : nullptr)
+	{
+		plan->SetBias(planIndex, bias);
+	}
+}
+
+void Node::InvalidatePlan()
+{
+	if (layer)
+	{
+		layer->GetNetwork()->InvalidatePlan();
+	}
+}
+
 void Node::Delete()
 {
+	// Synapses are removed while the layer still exists, unlinking them marks this node dirty through it
+	ClearSynapses();
 	if (layer)
 	{
-		layer->remove(this);
+		ClearDirty();
+		LeaveLayer();
 		layer->DeleteIfEmpty();
+		layer = nullptr;
 	}
 	delete this;
 }
 
+void Node::LeaveLayer()
+{
+	layer->erase(layerHook);
+	std::vector<Node*, ArenaAllocator<Node*>>& nodeIndex = layer->nodeIndex;
+	nodeIndex[layerPosition] = nodeIndex.back();
+	nodeIndex[layerPosition]->layerPosition = layerPosition;
+	nodeIndex.pop_back();
+}
+
+void Node::MarkDirty()
+{
+	if (layer && dirtyIndex == notDirty)
+	{
+		std::vector<Node*>& dirtyNodes = layer->GetNetwork()->dirtyNodes;
+		dirtyIndex = static_cast<uint32_t>(dirtyNodes.size());
+		dirtyNodes.push_back(this);
+	}
+}
+
+void Node::ClearDirty()
+{
+	if (layer && dirtyIndex != notDirty)
+	{
+		std::vector<Node*>& dirtyNodes = layer->GetNetwork()->dirtyNodes;
+		dirtyNodes[dirtyIndex] = dirtyNodes.back();
+		dirtyNodes[dirtyIndex]->dirtyIndex = dirtyIndex;
+		dirtyNodes.pop_back();
+		dirtyIndex = notDirty;
+	}
+}
+
 void Node::ClearInputs()
 {
 	while (!inputs.empty())
@@ -486,10 +625,13 @@ void Node::SetLayer(Layer* newLayer)
 	{
 		if (layer)
 		{
-			layer->remove(this);
+			LeaveLayer();
 		}
-		newLayer->push_back(this);
+		layerHook = newLayer->insert(newLayer->end(), this);
+		layerPosition = static_cast<uint32_t>(newLayer->nodeIndex.size());
+		newLayer->nodeIndex.push_back(this);
 		layer = newLayer;
+		MarkDirty();
 	}
 }
 
@@ -503,16 +645,40 @@ Synapse::~Synapse()
 	Unlink();
 }
 
+void Synapse::SetWeight(double newWeight)
+{
+	weight = newWeight;
+	Layer* layer = in->GetLayer();
+	if (CompiledNetwork* plan = layer ? layer->GetNetwork()->GetCurrentPlan() : nullptr)
+	{
+		plan->SetWeight(planIndex, weight);
+	}
+}
+
 void Synapse::Link()
 {
-	in->outputs.push_back(this);
-	out->inputs.push_back(this);
+	outputHook = in->outputs.insert(in->outputs.end(), this);
+	inputHook = out->inputs.insert(out->inputs.end(), this);
+	std::vector<Synapse*>& synapses = GetOwner(this)->synapses;
+	networkPosition = static_cast<uint32_t>(synapses.size());
+	synapses.push_back(this);
+	in->MarkDirty();
+	in->InvalidatePlan();
+	out->InvalidatePlan();
 }
 
 void Synapse::Unlink()
 {
-	in->outputs.remove(this);
-	out->inputs.remove(this);
+	in->outputs.erase(outputHook);
+	out->inputs.erase(inputHook);
+	std::vector<Synapse*>& synapses = GetOwner(this)->synapses;
+	synapses[networkPosition] = synapses.back();
+	synapses[networkPosition]->networkPosition = networkPosition;
+	synapses.pop_back();
+	in->MarkDirty();
+	out->MarkDirty();
+	in->InvalidatePlan();
+	out->InvalidatePlan();
 }
 
 
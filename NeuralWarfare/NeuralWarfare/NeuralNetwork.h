@@ -2,7 +2,51 @@
 #include <list>
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include "NetworkArena.h"
+
+/// <summary>
+/// Tags the built in activation functions so compiled networks can apply them with a span kernel instead of a virtual call per node.
+/// </summary>
+enum class ActivationKind : uint8_t
+{
+	Custom, // Evaluated through the virtual operator(), one call per value.
+	BasicAdd,
+	Step,
+	Sigmoid,
+	Tanh,
+	ReLU,
+	LeakyReLU,
+};
+
+/// <summary>
+/// Numeric precision a network is evaluated and saved in. The node graph always holds doubles.
+/// </summary>
+enum class Precision : uint8_t
+{
+	Float64,
+	Float32,
+};
+
+/// <summary>
+/// Gets the name a precision is written as in the hyperparameters, "float64" or "float32".
+/// </summary>
+inline const char* PrecisionName(Precision precision)
+{
+	return precision == Precision::Float32 ? "float32" : "float64";
+}
+
+/// <summary>
+/// Reads a precision from its name, returns false and leaves precision unchanged if the name is unknown.
+/// </summary>
+inline bool ParsePrecision(const std::string& name, Precision& precision)
+{
+	if (name == "float64") { precision = Precision::Float64; return true; }
+	if (name == "float32") { precision = Precision::Float32; return true; }
+	return false;
+}
 
 /// <summary>
 /// Represents an activation function used by neural network nodes.
@@ -11,6 +55,7 @@ class ActivationFunction
 {
 public:
 	std::string name; // The name of the activation function.
+	ActivationKind kind = ActivationKind::Custom; // Kernel used by compiled networks, subclasses that override operator() of a built in function must set this back to Custom.
 
 	/// <summary>
 	/// Virtual destructor for ActivationFunction.
@@ -28,9 +73,70 @@ private:
 
 };
 
+class NeuralNetwork;
 class Layer;
 class Node;
 class Synapse;
+class CompiledNetwork;
+
+using NodeList = std::list<Node*, ArenaAllocator<Node*>>; // List of nodes, allocated from the arena of their network.
+using SynapseList = std::list<Synapse*, ArenaAllocator<Synapse*>>; // List of synapses, allocated from the arena of their network.
+
+/// <summary>
+/// Base of the layers, nodes and synapses of a neural network, they are created with new (network) and live in the arena of that network.
+/// </summary>
+/// <remarks>
+/// Everything a network object owns is allocated from the same arena, so a whole network is released with its arena
+/// instead of deleting its objects one by one. Deleting a single object returns its memory to the arena for reuse.
+/// </remarks>
+class NetworkObject
+{
+public:
+	/// <summary>
+	/// Allocates an object from the arena of a neural network.
+	/// </summary>
+	/// <param name="size">Size of the object.</param>
+	/// <param name="network">The network the object belongs to.</param>
+	static void* operator new(size_t size, NeuralNetwork* network);
+
+	/// <summary>
+	/// Returns the memory of an object whose constructor threw to the arena, the size is read from the object's header.
+	/// </summary>
+	static void operator delete(void* ptr, NeuralNetwork* network);
+
+	/// <summary>
+	/// Returns a deleted object to the arena it was allocated from.
+	/// </summary>
+	static void operator delete(void* ptr, size_t size);
+
+protected:
+	/// <summary>
+	/// Gets the network an object was allocated for.
+	/// </summary>
+	/// <param name="object">Pointer to the object, as returned by new.</param>
+	/// <returns>The network.</returns>
+	static NeuralNetwork* GetOwner(const void* object);
+
+	/// <summary>
+	/// Gets the arena an object was allocated from.
+	/// </summary>
+	/// <param name="object">Pointer to the object, as returned by new.</param>
+	/// <returns>The arena.</returns>
+	static NetworkArena* GetArena(const void* object);
+
+private:
+	/// <summary>
+	/// Stored in front of each object.
+	/// </summary>
+	struct Header
+	{
+		NeuralNetwork* network; // The network the object belongs to, first so GetOwner reads one pointer.
+		size_t size; // Size of the object, lets the placement delete free it.
+	};
+
+	static constexpr size_t headerSize = NetworkArena::alignment; // Space before each object holding its header, keeps the object aligned.
+	static_assert(sizeof(Header) <= headerSize, "the header must fit in front of the object");
+};
 
 /// <summary>
 /// Represents a neural network composed of layers of nodes.
@@ -51,7 +157,7 @@ public:
 	NeuralNetwork(std::vector<ActivationFunction*>& functions);
 
 	/// <summary>
-	/// NeuralNetwork destructor.
+	/// NeuralNetwork destructor, releases all layers, nodes and synapses together with the arena.
 	/// </summary>
 	~NeuralNetwork();
 
@@ -74,31 +180,85 @@ public:
 	/// </summary>
 	/// <param name="inputValues">Vector of input values to the neural network.</param>
 	/// <returns>Vector of output values from the neural network.</returns>
-	std::vector<double> Evaluate(std::vector<double> inputValues);
+	std::vector<double> Evaluate(const std::vector<double>& inputValues);
+
+	/// <summary>
+	/// Evaluates the neural network with input and output buffers owned by the caller, does not allocate once the plan is compiled.
+	/// </summary>
+	/// <param name="inputValues">Input values to the neural network.</param>
+	/// <param name="inputCount">Number of input values, missing inputs are treated as 0.</param>
+	/// <param name="outputValues">Buffer for the output values of the neural network.</param>
+	/// <param name="outputCount">Size of the output buffer, outputs that do not fit are dropped.</param>
+	void Evaluate(const double* inputValues, size_t inputCount, double* outputValues, size_t outputCount);
 
 	/// <summary>
-	/// Updates the neural network (e.g., learning, adaptation).
+	/// Updates the neural network by propagating values through the node graph.
 	/// </summary>
+	/// <remarks>
+	/// This is the slow reference path, Evaluate runs from the compiled plan instead.
+	/// </remarks>
 	void Update();
 
+	/// <summary>
+	/// Gets the compiled plan of the neural network, compiling it first if the graph changed since the last compile.
+	/// </summary>
+	/// <returns>Pointer to the compiled plan, owned by the neural network.</returns>
+	CompiledNetwork* GetPlan();
+
+	/// <summary>
+	/// Gets the compiled plan of the neural network without compiling it.
+	/// </summary>
+	/// <returns>Pointer to the compiled plan, nullptr if the graph changed since the last compile.</returns>
+	CompiledNetwork* GetCurrentPlan() const { return plan; }
+
+	/// <summary>
+	/// Gets every synapse in the network, in no particular order.
+	/// </summary>
+	/// <returns>Array of the synapses, kept up to date as synapses are linked and unlinked.</returns>
+	const std::vector<Synapse*>& GetSynapses() const { return synapses; }
+
+	/// <summary>
+	/// Discards the compiled plan, called whenever the graph is mutated.
+	/// </summary>
+	void InvalidatePlan();
+
+	/// <summary>
+	/// Copies the node values from the last evaluation of the compiled plan into each node's outputValue.
+	/// </summary>
+	void SyncNodeOutputs();
+
+	/// <summary>
+	/// Gets the precision the network is evaluated and saved in.
+	/// </summary>
+	Precision GetPrecision() const { return precision; }
+
+	/// <summary>
+	/// Sets the precision the network is evaluated and saved in, the graph keeps its double values.
+	/// </summary>
+	/// <param name="newPrecision">The new precision.</param>
+	void SetPrecision(Precision newPrecision);
+
 	/// <summary>
 	/// Ensures all nodes in the neural network are fully connected.
 	/// </summary>
 	void MakeFullyConnected();
 
 	/// <summary>
-	/// Cleans up all synapses in the neural network.
+	/// Combines duplicate synapses leaving the nodes touched since the last clean.
 	/// </summary>
 	void CleanSynapses();
 
 	/// <summary>
-	/// Cleans up all nodes in the neural network.
+	/// Deletes the hidden nodes touched since the last clean that have no synapses left.
 	/// </summary>
 	void CleanNodes();
 
 	/// <summary>
-	/// Cleans up the entire neural network.
+	/// Cleans up the nodes and synapses touched since the last clean, the rest of the network is skipped.
 	/// </summary>
+	/// <remarks>
+	/// A node is touched when it joins a layer, gains an output synapse or loses any synapse.
+	/// </remarks>
 	void Clean();
 
 	/// <summary>
@@ -109,6 +269,10 @@ public:
 	/// <summary>
 	/// Creates a deep copy of an existing neural network.
 	/// </summary>
+	/// <remarks>
+	/// The copy is built from the dense node numbering of the compiled plan, which is compiled first if the network changed.
+	/// Copying the same network from several threads at once is only safe while it has a compiled plan.
+	/// </remarks>
 	/// <param name="oldNetwork">The neural network to copy.</param>
 	/// <returns>A new instance of the copied neural network.</returns>
 	static NeuralNetwork* Copy(NeuralNetwork* oldNetwork);
@@ -159,29 +323,49 @@ public:
 	Layer*& back() { return layers.back(); }
 	const Layer* back() const { return layers.back(); }
 
-	void push_front(Layer* value) { layers.push_front(value); }
-	void pop_front() { layers.pop_front(); }
+	void push_front(Layer* value) { layers.push_front(value); InvalidatePlan(); }
+	void pop_front() { layers.pop_front(); InvalidatePlan(); }
 
-	void push_back(Layer* value) { layers.push_back(value); }
-	void pop_back() { layers.pop_back(); }
+	void push_back(Layer* value) { layers.push_back(value); InvalidatePlan(); }
+	void pop_back() { layers.pop_back(); InvalidatePlan(); }
 
-	void clear() { layers.clear(); }
+	void clear() { layers.clear(); InvalidatePlan(); }
 
-	iterator insert(const_iterator pos, Layer* value) { return layers.insert(pos, value); }
-	iterator insert(const_iterator pos, size_t count, Layer* value) { return layers.insert(pos, count, value); }
+	iterator insert(const_iterator pos, Layer* value) { InvalidatePlan(); return layers.insert(pos, value); }
+	iterator insert(const_iterator pos, size_t count, Layer* value) { InvalidatePlan(); return layers.insert(pos, count, value); }
 
-	void resize(size_t count) { layers.resize(count); }
-	void resize(size_t count, Layer* value) { layers.resize(count, value); }
+	iterator erase(const_iterator pos) { InvalidatePlan(); return layers.erase(pos); }
 
-	void remove(Layer* value) { layers.remove(value); }
+	void resize(size_t count) { layers.resize(count); InvalidatePlan(); }
+	void resize(size_t count, Layer* value) { layers.resize(count, value); InvalidatePlan(); }
+
+	void remove(Layer* value) { layers.remove(value); InvalidatePlan(); }
 	template <typename Pr>
-	void remove_if(Pr p) { layers.remove_if(p); }
+	void remove_if(Pr p) { layers.remove_if(p); InvalidatePlan(); }
 
-	void reverse() { layers.reverse(); }
+	void reverse() { layers.reverse(); InvalidatePlan(); }
 
 private:
+	friend class CompiledNetwork;
+	friend class NetworkObject;
+	friend class Node;
+	friend class Synapse;
+
+	NetworkArena arena; // Memory of the layers, nodes and synapses of the network.
+	std::vector<Synapse*> synapses; // Every linked synapse, each synapse knows its own index in the array.
+	std::vector<Node*> dirtyNodes; // Nodes touched since the last clean, each node knows its own index in the array.
 	std::vector<Node*> inputNodes; // Array of input nodes in the neural network.
 	std::vector<Node*> outputNodes; // Array of output nodes in the neural network.
+	CompiledNetwork* plan = nullptr; // Compiled plan used by Evaluate, nullptr until compiled or after the graph changed.
+	Precision precision = Precision::Float64; // Precision the network is evaluated and saved in.
+
+	/// <summary>
+	/// Combines the output synapses of a node that lead to the same node, linear in the number of outputs.
+	/// </summary>
+	/// <param name="node">The node to clean.</param>
+	static void CombineDuplicateSynapses(Node* node);
+
+	static constexpr uint64_t fileMagic = 0x3174654E7261574Eull; // "NWarNet1", marks model files that start with a header. Older files start with the function count.
 
 
 	/// <summary>
@@ -210,6 +394,24 @@ private:
 		data.insert(data.end(), value.begin(), value.end());
 	}
 
+	/// <summary>
+	/// Appends a bias or weight in the precision the file is saved in.
+	/// </summary>
+	/// <param name="data">Vector of characters representing binary data.</param>
+	/// <param name="value">Value to append.</param>
+	/// <param name="precision">Precision to store the value in.</param>
+	static void AppendParameter(std::vector<char>& data, double value, Precision precision)
+	{
+		if (precision == Precision::Float32)
+		{
+			AppendToData(data, static_cast<float>(value));
+		}
+		else
+		{
+			AppendToData(data, value);
+		}
+	}
+
 	/// <summary>
 	/// Extracts a value from a vector of characters representing binary data.
 	/// </summary>
@@ -224,6 +426,27 @@ private:
 		offset += sizeof(T);
 	}
 	
+	/// <summary>
+	/// Extracts a bias or weight stored in the precision the file was saved in.
+	/// </summary>
+	/// <param name="data">Vector of characters representing binary data.</param>
+	/// <param name="offset">Offset within the binary data to start extracting from.</param>
+	/// <param name="value">Extracted value.</param>
+	/// <param name="precision">Precision the value is stored in.</param>
+	static void ExtractParameter(const std::vector<char>& data, size_t& offset, double& value, Precision precision)
+	{
+		if (precision == Precision::Float32)
+		{
+			float stored;
+			ExtractFromData(data, offset, stored);
+			value = stored;
+		}
+		else
+		{
+			ExtractFromData(data, offset, value);
+		}
+	}
+
 	/// <summary>
 	/// Extracts a string from a vector of characters representing binary data.
 	/// </summary>
@@ -240,15 +463,22 @@ private:
 
 };
 
-class Layer
+/// <summary>
+/// Represents a layer of nodes within a neural network.
+/// </summary>
+/// <remarks>
+/// Nodes join and leave a layer through Node::SetLayer and Node::Delete, which also keep NodeAt up to date.
+/// </remarks>
+class Layer : public NetworkObject
 {
 private:
-	std::list<Node*> nodes; // List of nodes within the layer.
+	NodeList nodes; // List of nodes within the layer.
+	std::vector<Node*, ArenaAllocator<Node*>> nodeIndex; // The same nodes in no particular order, for random access.
 	NeuralNetwork* neuralNetwork; // Pointer to the parent neural network.
 
 public:
-	using iterator = std::list<Node*>::iterator; // Iterator type for accessing nodes.
-	using const_iterator = std::list<Node*>::const_iterator; // Const iterator type for accessing nodes.
+	using iterator = NodeList::iterator; // Iterator type for accessing nodes.
+	using const_iterator = NodeList::const_iterator; // Const iterator type for accessing nodes.
 
 	/// <summary>
 	/// Constructs a layer within a neural network.
@@ -278,6 +508,19 @@ public:
 	/// </summary>
 	void Delete();
 
+	/// <summary>
+	/// Gets the neural network containing the layer.
+	/// </summary>
+	/// <returns>Pointer to the parent neural network.</returns>
+	NeuralNetwork* GetNetwork() const { return neuralNetwork; }
+
+	/// <summary>
+	/// Gets a node by index in constant time, the order differs from the list order.
+	/// </summary>
+	/// <param name="index">Index of the node, less than size().</param>
+	/// <returns>Pointer to the node.</returns>
+	Node* NodeAt(size_t index) const { return nodeIndex[index]; }
+
 	// List interface methods:
 
 	iterator begin() { return nodes.begin(); }
@@ -293,33 +536,38 @@ public:
 	Node*& back() { return nodes.back(); }
 	const Node* back() const { return nodes.back(); }
 
-	void push_front(Node* value) { nodes.push_front(value); }
-	void pop_front() { nodes.pop_front(); }
+	void push_front(Node* value) { nodes.push_front(value); neuralNetwork->InvalidatePlan(); }
+	void pop_front() { nodes.pop_front(); neuralNetwork->InvalidatePlan(); }
+
+	void push_back(Node* value) { nodes.push_back(value); neuralNetwork->InvalidatePlan(); }
+	void pop_back() { nodes.pop_back(); neuralNetwork->InvalidatePlan(); }
 
-	void push_back(Node* value) { nodes.push_back(value); }
-	void pop_back() { nodes.pop_back(); }
+	void clear() { nodes.clear(); neuralNetwork->InvalidatePlan(); }
 
-	void clear() { nodes.clear(); }
+	iterator insert(const_iterator pos, Node* value) { neuralNetwork->InvalidatePlan(); return nodes.insert(pos, value); }
+	iterator insert(const_iterator pos, size_t count, Node* value) { neuralNetwork->InvalidatePlan(); return nodes.insert(pos, count, value); }
 
-	iterator insert(const_iterator pos, Node* value) { return nodes.insert(pos, value); }
-	iterator insert(const_iterator pos, size_t count, Node* value) { return nodes.insert(pos, count, value); }
+	iterator erase(const_iterator pos) { neuralNetwork->InvalidatePlan(); return nodes.erase(pos); }
 	
-	void resize(size_t count) { nodes.resize(count); }
-	void resize(size_t count, Node* value) { nodes.resize(count, value); }
+	void resize(size_t count) { nodes.resize(count); neuralNetwork->InvalidatePlan(); }
+	void resize(size_t count, Node* value) { nodes.resize(count, value); neuralNetwork->InvalidatePlan(); }
 
-	void remove(Node* value) { nodes.remove(value); }
+	void remove(Node* value) { nodes.remove(value); neuralNetwork->InvalidatePlan(); }
 	template <typename Pr>
-	void remove_if(Pr p) { nodes.remove_if(p); }
+	void remove_if(Pr p) { nodes.remove_if(p); neuralNetwork->InvalidatePlan(); }
 
-	void reverse() { nodes.reverse(); };
+	void reverse() { nodes.reverse(); neuralNetwork->InvalidatePlan(); }
 
 private:
+	friend class Node;
+
+	NeuralNetwork::iterator networkHook; // Position of the layer in its network's list, so it is removed without a search.
 };
 
 /// <summary>
 /// Represents a node within a neural network layer.
 /// </summary>
-class Node
+class Node : public NetworkObject
 {
 public:
 	/// <summary>
@@ -342,12 +590,18 @@ public:
 	/// </summary>
 	~Node();
 
-	double bias = 0; // Bias value of the node.
+	double bias = 0; // Bias value of the node, change it through SetBias so the compiled plan is updated.
 	double inputValue = bias; // Input value to the node.
 	double outputValue = 0; // Output value from the node.
 
 	ActivationFunction* function; // Activation function used by the node.
 
+	/// <summary>
+	/// Sets the bias of the node and patches it into the compiled plan of its network.
+	/// </summary>
+	/// <param name="newBias">The new bias value.</param>
+	void SetBias(double newBias);
+
 	/// <summary>
 	/// Updates the state of the node based on its inputs and current parameters.
 	/// </summary>
@@ -379,17 +633,53 @@ public:
 	/// </summary>
 	void Delete();
 
-	std::list<Synapse*> inputs; // List of input synapses (connections) to the node.
-	std::list<Synapse*> outputs; // List of output synapses (connections) from the node.
+	/// <summary>
+	/// Gets the layer containing the node.
+	/// </summary>
+	/// <returns>Pointer to the layer, nullptr if the node has not been added to a layer yet.</returns>
+	Layer* GetLayer() const { return layer; }
+
+	/// <summary>
+	/// Invalidates the compiled plan of the network containing the node.
+	/// </summary>
+	void InvalidatePlan();
+
+	/// <summary>
+	/// Adds the node to the nodes its network checks on the next clean.
+	/// </summary>
+	void MarkDirty();
+
+	SynapseList inputs; // List of input synapses (connections) to the node.
+	SynapseList outputs; // List of output synapses (connections) from the node.
 
 private:
-	Layer* layer; // Pointer to the layer that contains the node.
+	friend class CompiledNetwork;
+	friend class NeuralNetwork;
+
+	Layer* layer = nullptr; // Pointer to the layer that contains the node.
+	Layer::iterator layerHook; // Position of the node in its layer's list, so it is removed without a search.
+	uint32_t layerPosition = 0; // Index of the node in its layer's nodeIndex.
+	uint32_t dirtyIndex = notDirty; // Index of the node in its network's dirtyNodes, notDirty if it is not in it.
+	Synapse* mergeSynapse = nullptr; // Scratch used by Clean, the synapse from the node being cleaned into this node.
+
+	static constexpr uint32_t notDirty = UINT32_MAX;
+
+	/// <summary>
+	/// Removes the node from its network's dirtyNodes.
+	/// </summary>
+	void ClearDirty();
+
+	/// <summary>
+	/// Removes the node from its layer's list and index.
+	/// </summary>
+	void LeaveLayer();
+	uint32_t planIndex = 0; // Index of the node in the compiled plan, assigned when the plan is compiled.
 };
 
 /// <summary>
 /// Represents a synapse (connection) between two nodes in a neural network.
 /// </summary>
-class Synapse
+class Synapse : public NetworkObject
 {
 public:
 	/// <summary>
@@ -407,7 +697,13 @@ public:
 
 	Node* in; // Pointer to the input node of the synapse.
 	Node* out; // Pointer to the output node of the synapse.
-	double weight; // Weight (strength) of the synapse.
+	double weight; // Weight (strength) of the synapse, change it through SetWeight so the compiled plan is updated.
+
+	/// <summary>
+	/// Sets the weight of the synapse and patches it into the compiled plan of its network.
+	/// </summary>
+	/// <param name="newWeight">The new weight value.</param>
+	void SetWeight(double newWeight);
 
 	/// <summary>
 	/// Establishes (links) the connection between the input and output nodes.
@@ -415,10 +711,17 @@ public:
 	void Link();
 
 	/// <summary>
-	/// Removes (unlinks) the connection between the input and output nodes.
+	/// Removes (unlinks) the connection between the input and output nodes in constant time.
 	/// </summary>
+	/// <remarks>Must only be called on a linked synapse.</remarks>
 	void Unlink();
 
 private:
+	friend class CompiledNetwork;
+	friend class NeuralNetwork;
 
+	uint32_t planIndex = 0; // Index of the synapse in the compiled plan, assigned when the plan is compiled.
+	SynapseList::iterator outputHook; // Position of the synapse in in->outputs, so it is unlinked without a search.
+	SynapseList::iterator inputHook; // Position of the synapse in out->inputs.
+	uint32_t networkPosition = 0; // Index of the synapse in its network's synapses.
 };
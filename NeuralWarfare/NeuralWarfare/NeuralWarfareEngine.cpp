@@ -1,66 +1,59 @@
 #include "NeuralWarfareEngine.h"
 #include <iostream>
 #include "angleTools.h"
+#include "RandomStream.h"
 
 float agentSize = 4;
 
-NeuralWarfareEngine::Agent::Agent(size_t teamId, Vec2 pos, float health, double dir) :
-    teamId(teamId),
-    spawnPos(pos),
-    baseHealth(health),
-    dir(dir)
-{
-    Reset();
-}
+// Fewest neighbor queries handed to a thread, a query is quick so smaller runs cost more to hand out than they save
+static constexpr size_t neighborQueryGrain = 256;
 
-NeuralWarfareEngine::Agent::~Agent()
-{
-}
-
-void NeuralWarfareEngine::Agent::UpdatePos(float delta)
-{
-    dir = normalizeAngle(dir);
-    pos.x += cos(dir) * delta;
-    pos.y += sin(dir) * delta;
-}
+// Fewest agents in a part of the collision stage, for the same reason
+static constexpr size_t collisionPartitionSize = 1024;
 
-void NeuralWarfareEngine::Agent::Reset()
+void NeuralWarfareEngine::MoveAgent(size_t index, float delta)
 {
-    pos = spawnPos;
-    health = baseHealth;
-    kills = 0;
+    double dir = normalizeAngle(agents.dir[index]);
+    agents.dir[index] = dir;
+    agents.x[index] += cos(dir) * delta;
+    agents.y[index] += sin(dir) * delta;
 }
 
-void NeuralWarfareEngine::DoCollision(Agent* agentA, Agent* agentB)
+void NeuralWarfareEngine::DoCollision(AgentPoint* pointA, AgentPoint* pointB)
 {
-    Vec2 colVec = agentA->pos - agentB->pos;
+    size_t a = pointA->index;
+    size_t b = pointB->index;
+    Vec2 colVec = agents.Pos(a) - agents.Pos(b);
     double colAngle = colVec.Direction();
 
     // Calculate the difference in direction angles, normalized to [-pi, pi]
-    double diffA = normalizeAngle(colAngle - agentA->dir);
-    double diffB = normalizeAngle(colAngle + std::numbers::pi - agentB->dir);
+    double diffA = normalizeAngle(colAngle - agents.dir[a]);
+    double diffB = normalizeAngle(colAngle + std::numbers::pi - agents.dir[b]);
 
     if (diffA > diffB) 
     {
-        agentA->health -= 1;
-        agentB->reward += 1;
-        agentB->kills += 1;
-        agentA->UpdatePos(agentSize * 2);
-        agentB->UpdatePos(agentSize * 2);
+        agents.health[a] -= 1;
+        agents.reward[b] += 1;
+        agents.kills[b] += 1;
+        MoveAgent(a, agentSize * 2);
+        MoveAgent(b, agentSize * 2);
     }
     if (diffA < diffB)
     {
-        agentB->health -= 1;
-        agentA->reward += 1;
-        agentA->kills += 1;
-        agentA->UpdatePos(agentSize * 2);
-        agentB->UpdatePos(agentSize * 2);
+        agents.health[b] -= 1;
+        agents.reward[a] += 1;
+        agents.kills[a] += 1;
+        MoveAgent(a, agentSize * 2);
+        MoveAgent(b, agentSize * 2);
     }
+    // Queries after the update see the agents where they were pushed to
+    pointA->pos = agents.Pos(a);
+    pointB->pos = agents.Pos(b);
 }
 
-NeuralWarfareEngine::NeuralWarfareEngine(std::mt19937& gen, Vec2 simSize) : gen(gen), simSize(simSize)
+NeuralWarfareEngine::NeuralWarfareEngine(uint64_t seed, Vec2 simSize) : seed(seed), simSize(simSize)
 {
-    UpdateKDTree();
+    UpdateSpatialIndex();
 }
 
 NeuralWarfareEngine::~NeuralWarfareEngine()
@@ -70,129 +63,392 @@ NeuralWarfareEngine::~NeuralWarfareEngine()
 void NeuralWarfareEngine::Update(float delta)
 {
     wasReset = false;
+    const size_t count = agents.Size();
+    float* x = agents.x.data();
+    float* y = agents.y.data();
+    double* dir = agents.dir.data();
+    float* health = agents.health.data();
+
+    std::fill(agents.reward.begin(), agents.reward.end(), 1.0f);
+
+    //handle simulation boundary
     float doubleAgentSize = agentSize * 2;
-	for (Agent& agent : agents)
-	{
-        agent.reward = 1;
-        //handle simulation boundary
-        if (agent.pos.x < -simSize.x + doubleAgentSize ||
-            agent.pos.y < -simSize.y + doubleAgentSize ||
-            agent.pos.x > simSize.x - doubleAgentSize ||
-            agent.pos.y > simSize.y - doubleAgentSize)
-        {
-            agent.health = 0;
-            //agent.pos = -(agent.pos - agent.pos.Normalize() * (delta + 1));
-        }
+    const float minX = -simSize.x + doubleAgentSize;
+    const float minY = -simSize.y + doubleAgentSize;
+    const float maxX = simSize.x - doubleAgentSize;
+    const float maxY = simSize.y - doubleAgentSize;
+    for (size_t i = 0; i < count; i++)
+    {
+        // | rather than || keeps the loop free of branches so it vectorizes
+        bool outside = (x[i] < minX) | (y[i] < minY) | (x[i] > maxX) | (y[i] > maxY);
+        health[i] = outside ? 0.0f : health[i];
+    }
 
-        //if (agent.pos.x < -simSize.x)
-        //{
-        //    agent.pos.x = -simSize.x;
-        //}
-        //else if (agent.pos.x > simSize.x)
-        //{
-        //    agent.pos.x = simSize.x;
-        //}
-        //if (agent.pos.y < -simSize.y)
-        //{
-        //    agent.pos.y = -simSize.y;
-        //}
-        //else if (agent.pos.y > simSize.y)
-        //{
-        //    agent.pos.y = simSize.y;
-        //}
-
-        agent.UpdatePos(delta);
-	}
+    for (size_t i = 0; i < count; i++)
+    {
+        dir[i] = normalizeAngle(dir[i]);
+        x[i] += cos(dir[i]) * delta;
+        y[i] += sin(dir[i]) * delta;
+    }
 
-    UpdateKDTree();
-    DoCollisions(kdTree.root);
+    UpdateSpatialIndex();
+    DoCollisions();
 
 }
 
 void NeuralWarfareEngine::Reset()
 {
-    for (Agent& agent : agents)
+    std::copy(agents.spawnX.begin(), agents.spawnX.end(), agents.x.begin());
+    std::copy(agents.spawnY.begin(), agents.spawnY.end(), agents.y.begin());
+    std::copy(agents.baseHealth.begin(), agents.baseHealth.end(), agents.health.begin());
+    std::fill(agents.kills.begin(), agents.kills.end(), 0);
+    SyncSpatialPoints();
+    wasReset = true;
+}
+
+void NeuralWarfareEngine::SetBroadphase(Broadphase newBroadphase)
+{
+    broadphase = newBroadphase;
+    UpdateSpatialIndex();
+}
+
+void NeuralWarfareEngine::FindAgentNeighbors(size_t agent, KDTree<AgentPoint>::NeighborSet& hostile, KDTree<AgentPoint>::NeighborSet& friendly) const
+{
+    const size_t team = agents.team[agent];
+    const Vec2 pos = agents.Pos(agent);
+    if (broadphase == Broadphase::Grid)
     {
-        agent.Reset();
+        KDTree<AgentPoint>::NeighborSet sets[2] = { hostile, friendly };
+        // Set 0 takes hostile agents, set 1 friendly agents and 2 leaves an agent out
+        grid.FindNearestNeighbors(pos, sets, 2, [this, team, agent](const AgentPoint* p) -> size_t
+            {
+                if (agents.health[p->index] <= 0) return 2;
+                if (agents.team[p->index] != team) return 0;
+                return p->index != agent ? 1 : 2;
+            });
+        hostile.count = sets[0].count;
+        friendly.count = sets[1].count;
+        return;
     }
-    wasReset = true;
+
+    // Most agents of the tree are hostile once there are a few teams, so the shared tree suits the hostile search
+    const uint64_t teamGroup = TeamGroup(team);
+    kdTree.FindNearestNeighbors(pos, &hostile, 1, [this, team](const AgentPoint* p) -> size_t
+        {
+            return agents.team[p->index] != team && agents.health[p->index] > 0 ? 0 : 1;
+        }, teamGroupsExact ? ~teamGroup : KDTree<AgentPoint>::allGroups);
+    // and the team's own tree the friendly search
+    for (const TeamTree& teamTree : teamTrees)
+    {
+        if (teamTree.team == team)
+        {
+            teamTree.tree.FindNearestNeighbors(pos, &friendly, 1, [this, agent](const AgentPoint* p) -> size_t
+                {
+                    return agents.health[p->index] > 0 && p->index != agent ? 0 : 1;
+                });
+        }
+    }
+}
+
+// Spreads the low 16 bits of a value over the even bits, so two spread values interleave into a Morton code
+static uint32_t SpreadBits(uint32_t v)
+{
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
 }
 
-void NeuralWarfareEngine::UpdateKDTree()
+void NeuralWarfareEngine::FindAgentNeighbors(const std::vector<size_t>& queryAgents, size_t hostileK, size_t friendlyK, NeighborBatch& batch)
 {
-    std::vector<Agent*> agentVector;
-    Agent* lastAdded = nullptr;
+    const size_t count = queryAgents.size();
+    batch.hostileK = hostileK;
+    batch.friendlyK = friendlyK;
+    batch.hostile.resize(count * hostileK);
+    batch.friendly.resize(count * friendlyK);
+    batch.hostileCount.assign(count, 0);
+    batch.friendlyCount.assign(count, 0);
+
+    // Morton code of each query in the high bits and its position in the batch in the low bits, sorting these orders the queries along the curve
+    batch.order.clear();
+    const float scaleX = 0xFFFF / std::max(2 * simSize.x, 1.0f);
+    const float scaleY = 0xFFFF / std::max(2 * simSize.y, 1.0f);
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t agent = queryAgents[i];
+        if (agent == noAgent) continue;
+        uint32_t cellX = static_cast<uint32_t>(std::clamp((agents.x[agent] + simSize.x) * scaleX, 0.0f, 65535.0f));
+        uint32_t cellY = static_cast<uint32_t>(std::clamp((agents.y[agent] + simSize.y) * scaleY, 0.0f, 65535.0f));
+        uint64_t code = SpreadBits(cellX) | (SpreadBits(cellY) << 1);
+        batch.order.push_back(code << 32 | i);
+    }
+    std::sort(batch.order.begin(), batch.order.end());
+
+    // Each query writes only its own slots, so runs of queries can go to any thread
+    auto search = [this, &batch, &queryAgents](size_t begin, size_t end)
+        {
+            for (size_t q = begin; q < end; q++)
+            {
+                size_t i = static_cast<uint32_t>(batch.order[q]);
+                KDTree<AgentPoint>::NeighborSet hostile{ batch.hostile.data() + i * batch.hostileK, batch.hostileK };
+                KDTree<AgentPoint>::NeighborSet friendly{ batch.friendly.data() + i * batch.friendlyK, batch.friendlyK };
+                FindAgentNeighbors(queryAgents[i], hostile, friendly);
+                batch.hostileCount[i] = hostile.count;
+                batch.friendlyCount[i] = friendly.count;
+            }
+        };
+    if (pool)
+    {
+        pool->ParallelFor(batch.order.size(), neighborQueryGrain, search);
+    }
+    else
+    {
+        search(0, batch.order.size());
+    }
+}
+
+void NeuralWarfareEngine::UpdateSpatialIndex()
+{
+    spatialPoints.clear();
+    size_t lastAdded = noAgent;
     float blurRange = agentSize * 5;
-    for (Agent& agent : agents)
+    for (size_t i = 0; i < agents.Size(); i++)
     {
-        if (agent.health > 0 && (lastAdded == nullptr || lastAdded->teamId != agent.teamId || (lastAdded->pos - agent.pos).Length() > blurRange))
+        if (agents.health[i] > 0 && (lastAdded == noAgent || agents.team[lastAdded] != agents.team[i] || (agents.Pos(lastAdded) - agents.Pos(i)).Length() > blurRange))
         {
-            agentVector.push_back(&agent);
-            lastAdded = &agent;
+            spatialPoints.push_back(AgentPoint{ agents.Pos(i), i });
+            lastAdded = i;
         }
     }
+    // Pointers are taken once every point is added, so growing spatialPoints cannot move them
+    spatialPointers.clear();
+    for (AgentPoint& point : spatialPoints)
+    {
+        spatialPointers.push_back(&point);
+    }
+
+    kdTree.Clear();
+    if (broadphase == Broadphase::Grid)
+    {
+        teamTrees.clear();
+        // Cells are at least as wide as the collision range and hold about one agent each on average
+        float cellSize = std::max(agentSize * 2, std::sqrt(4 * simSize.x * simSize.y / std::max<size_t>(spatialPoints.size(), 1)));
+        grid.Build(spatialPointers, Vec2(-simSize.x, -simSize.y), simSize, cellSize);
+        return;
+    }
 
-    kdTree.Clear(kdTree.root);
-    kdTree.root = kdTree.Build(agentVector, 0);
+    // The agents of a team sit next to each other, so each team is one run of spatialPointers
+    teamTreeStart.clear();
+    for (size_t i = 0; i < spatialPoints.size(); i++)
+    {
+        if (i == 0 || agents.team[spatialPoints[i].index] != agents.team[spatialPoints[i - 1].index])
+        {
+            teamTreeStart.push_back(i);
+        }
+    }
+    teamTreeStart.push_back(spatialPoints.size());
+    // Teams are numbered upwards, so no two teams share a group while the last team is below 64
+    teamGroupsExact = agents.Size() == 0 || agents.team.back() < 64;
+    // resize keeps the trees that stay, so their storage is reused
+    teamTrees.resize(teamTreeStart.size() - 1);
+    // Task 0 builds the shared tree and task i the tree of team i - 1
+    auto build = [this](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                if (i == 0)
+                {
+                    kdTree.Build(spatialPointers, pool);
+                    kdTree.SetGroups([this](const AgentPoint* p) { return TeamGroup(agents.team[p->index]); });
+                    continue;
+                }
+                TeamTree& teamTree = teamTrees[i - 1];
+                teamTree.team = agents.team[spatialPoints[teamTreeStart[i - 1]].index];
+                teamTree.tree.Build(spatialPointers.data() + teamTreeStart[i - 1], teamTreeStart[i] - teamTreeStart[i - 1], pool);
+            }
+        };
+    if (pool)
+    {
+        pool->ParallelFor(teamTrees.size() + 1, 1, build);
+    }
+    else
+    {
+        build(0, teamTrees.size() + 1);
+    }
+}
+
+void NeuralWarfareEngine::SyncSpatialPoints()
+{
+    for (AgentPoint& point : spatialPoints)
+    {
+        point.pos = agents.Pos(point.index);
+    }
 }
 
-void NeuralWarfareEngine::DoCollisions(KDTree<Agent>::KDNode* node)
+void NeuralWarfareEngine::DoCollisions()
 {
-    if (!node) return;
-    std::vector<NeuralWarfareEngine::Agent*> others;
-    if (node->point->health > 0)
+    const size_t partitionCount = pool ? std::clamp<size_t>(spatialPoints.size() / collisionPartitionSize, 1, pool->ThreadCount() * 4) : 1;
+    if (collisionPartitions.size() < partitionCount)
     {
-        kdTree.FindRange(node, node->point->pos, agentSize * 2, 0, others,
-            [node](const NeuralWarfareEngine::Agent* a)
+        collisionPartitions.resize(partitionCount);
+    }
+    auto find = [this, partitionCount](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
             {
-                return a->teamId != node->point->teamId && a->health > 0;
-            });
+                FindContacts(i, partitionCount, collisionPartitions[i]);
+            }
+        };
+    if (partitionCount > 1)
+    {
+        pool->ParallelFor(partitionCount, 1, find);
     }
-    for (Agent* agent : others)
+    else
     {
-        DoCollision(node->point, agent);
+        find(0, 1);
     }
 
-    DoCollisions(node->left);
-    DoCollisions(node->right);
+    // Contacts are applied in order of their agents, so the result does not depend on how the search was split
+    contacts.clear();
+    for (size_t i = 0; i < partitionCount; i++)
+    {
+        contacts.insert(contacts.end(), collisionPartitions[i].contacts.begin(), collisionPartitions[i].contacts.end());
+    }
+    std::sort(contacts.begin(), contacts.end(), [](const Contact& x, const Contact& y)
+        {
+            return x.a->index != y.a->index ? x.a->index < y.a->index : x.b->index < y.b->index;
+        });
+    const float rangeSquared = agentSize * 2 * agentSize * 2;
+    for (const Contact& contact : contacts)
+    {
+        // An agent killed by an earlier contact of this stage takes part in no more, and agents pushed apart by one no longer touch
+        const size_t a = contact.a->index;
+        const size_t b = contact.b->index;
+        const float dx = agents.x[a] - agents.x[b];
+        const float dy = agents.y[a] - agents.y[b];
+        if (agents.health[a] > 0 && agents.health[b] > 0 && dx * dx + dy * dy < rangeSquared)
+        {
+            DoCollision(contact.a, contact.b);
+        }
+    }
+}
+
+void NeuralWarfareEngine::FindContacts(size_t partition, size_t partitionCount, CollisionPartition& out) const
+{
+    out.contacts.clear();
+    const float range = agentSize * 2;
+    if (broadphase == Broadphase::Grid)
+    {
+        // Each part walks a band of rows, the grid visits each pair from one band only
+        const int firstRow = static_cast<int>(grid.Rows() * partition / partitionCount);
+        const int endRow = static_cast<int>(grid.Rows() * (partition + 1) / partitionCount);
+        grid.ForEachPair(range, firstRow, endRow, [this, &out](AgentPoint* a, AgentPoint* b)
+            {
+                if (agents.team[a->index] != agents.team[b->index] && agents.health[a->index] > 0 && agents.health[b->index] > 0)
+                {
+                    out.contacts.push_back(Contact::Between(a, b));
+                }
+            });
+        return;
+    }
+
+    // Each part takes a run of the tree order, which covers a compact area
+    const size_t begin = kdTree.Size() * partition / partitionCount;
+    const size_t end = kdTree.Size() * (partition + 1) / partitionCount;
+    for (size_t i = begin; i < end; i++)
+    {
+        AgentPoint* point = kdTree.At(i);
+        const size_t team = agents.team[point->index];
+        if (agents.health[point->index] <= 0) continue;
+        // Only agents of later teams are looked for, so each pair is found once, from the agent of the earlier team
+        const uint64_t laterTeams = teamGroupsExact ? ~((TeamGroup(team) << 1) - 1) : KDTree<AgentPoint>::allGroups;
+        out.inRange.clear();
+        kdTree.FindRange(kdTree.Root(), point->pos, range, 0, out.inRange,
+            [this, team](const AgentPoint* p)
+            {
+                return agents.team[p->index] > team && agents.health[p->index] > 0;
+            }, laterTeams);
+        for (AgentPoint* other : out.inRange)
+        {
+            out.contacts.push_back(Contact::Between(point, other));
+        }
+    }
 }
 
 size_t NeuralWarfareEngine::AddTeam(size_t numAgents, float health, Vec2 pos)
 {
 	size_t teamid;
-	if (agents.size() == 0)
+	if (agents.Size() == 0)
 	{
         teamid = 0;
 	}
 	else
 	{
-        teamid = agents.back().teamId + 1;
+        teamid = agents.team.back() + 1;
 	}
+    // Each team draws from its own stream, so its spawn directions do not depend on the other teams
+    RandomStream stream(seed, 0, static_cast<uint32_t>(teamid), RandomPurpose::Spawn);
     std::uniform_real_distribution<float> radDis(0, std::numbers::pi * 2);
     for (size_t i = 0; i < numAgents; i++)
     {
-        agents.push_back(Agent(teamid, pos, health, radDis(gen)));
+        agents.x.push_back(pos.x);
+        agents.y.push_back(pos.y);
+        agents.dir.push_back(radDis(stream));
+        agents.health.push_back(health);
+        agents.team.push_back(teamid);
+        agents.kills.push_back(0);
+        agents.reward.push_back(0);
+        agents.baseHealth.push_back(health);
+        agents.spawnX.push_back(pos.x);
+        agents.spawnY.push_back(pos.y);
+        agents.handle.push_back(handleIndex.size());
+        handleIndex.push_back(agents.Size() - 1);
     }
 	return teamid;
 }
 
 void NeuralWarfareEngine::RemoveTeam(size_t teamID)
 {
-    std::list<Agent>::iterator iter = agents.begin();
-    while (iter != agents.end())
+    // Moves the kept agents down over the removed ones, in order
+    size_t kept = 0;
+    for (size_t i = 0; i < agents.Size(); i++)
     {
-        if ((*iter).teamId = teamID)
-        {
-            iter = agents.erase(iter);
-        }
-        else
+        if (agents.team[i] == teamID)
         {
-            iter++;
+            handleIndex[agents.handle[i]] = noAgent;
+            continue;
         }
+        agents.x[kept] = agents.x[i];
+        agents.y[kept] = agents.y[i];
+        agents.dir[kept] = agents.dir[i];
+        agents.health[kept] = agents.health[i];
+        agents.team[kept] = agents.team[i];
+        agents.kills[kept] = agents.kills[i];
+        agents.reward[kept] = agents.reward[i];
+        agents.baseHealth[kept] = agents.baseHealth[i];
+        agents.spawnX[kept] = agents.spawnX[i];
+        agents.spawnY[kept] = agents.spawnY[i];
+        agents.handle[kept] = agents.handle[i];
+        handleIndex[agents.handle[kept]] = kept;
+        kept++;
     }
+    agents.x.resize(kept);
+    agents.y.resize(kept);
+    agents.dir.resize(kept);
+    agents.health.resize(kept);
+    agents.team.resize(kept);
+    agents.kills.resize(kept);
+    agents.reward.resize(kept);
+    agents.baseHealth.resize(kept);
+    agents.spawnX.resize(kept);
+    agents.spawnY.resize(kept);
+    agents.handle.resize(kept);
+    // The spatial index points at indices that have moved
+    UpdateSpatialIndex();
 }
 
-
 /// <summary>
 /// Helper function to convert HSL to RGB
 /// </summary>
@@ -248,26 +504,3 @@ Color NeuralWarfareEngine::GenerateTeamColor(size_t teamID) {
 
     return HSLToRGB(hue, saturation, lightness);
 }
-
-void NeuralWarfareEngine::Draw(Rectangle drawRec)
-{
-    size_t lastTeamId = 0;
-    Color teamColor = GenerateTeamColor(lastTeamId);
-    Vec2 drawScale = Vec2(drawRec.width, drawRec.height) / simSize / 2;
-    Vec2 drawCenter(drawRec.x + drawRec.width / 2, drawRec.y + drawRec.height / 2);
-
-	for (Agent& agent : agents)
-	{
-        if (agent.health <= 0)
-        {
-            continue;
-        }
-        if (agent.teamId != lastTeamId)
-        {
-            lastTeamId = agent.teamId;
-            teamColor = GenerateTeamColor(lastTeamId);
-        }
-        Vec2 drawPos = drawCenter + agent.pos * drawScale;
-        DrawEllipse(drawPos.x, drawPos.y, agentSize * drawScale.x, agentSize * drawScale.y, teamColor);
-	}
-}
@@ -1,9 +1,11 @@
 #pragma once
-#include <list>
+#include <cstdint>
 #include <vector>
 #include <random>
 #include "raylib.h"
 #include "KDTree.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
 
 /// <summary>
 /// Engine for the NeuralWarfare environment
@@ -17,67 +19,170 @@ public:
 	/// <summary>
 	/// Engine constructor
 	/// </summary>
-	/// <param name="gen"> reference to the random number generator</param>
+	/// <param name="seed"> seed of the run, spawn directions are drawn from streams derived from it</param>
 	/// <param name="simSize"> the size of the simulation, measured from center </param>
-	NeuralWarfareEngine(std::mt19937& gen, Vec2 simSize);
+	NeuralWarfareEngine(uint64_t seed, Vec2 simSize);
 
 	/// <summary>
 	/// Engine destructor
 	/// </summary>
 	~NeuralWarfareEngine();
 
+	using AgentHandle = size_t; // Identifies an agent for its whole life, unlike its index which moves when other agents are removed
+
+	static constexpr size_t noAgent = SIZE_MAX; // Index or handle of no agent
+
 	/// <summary>
-	/// Agents are the basic players in the environment
+	/// State of every agent, stored as one array per field
 	/// </summary>
-	static class Agent
+	/// <remarks>
+	/// Element i of each array belongs to the agent at index i, and the agents of a team sit next to each other.
+	/// Passes over the agents read each field in order, which keeps them cache friendly and lets the compiler vectorize them.
+	/// </remarks>
+	struct AgentArrays
 	{
-	public:
+		std::vector<float> x; // x position
+		std::vector<float> y; // y position
+		std::vector<double> dir; // direction in radians
+		std::vector<float> health; // agent health
+		std::vector<size_t> team; // team ID
+		std::vector<size_t> kills; // kills this episode
+		std::vector<float> reward; // reward of the last update
+		std::vector<float> baseHealth; // agent spawn/starting health
+		std::vector<float> spawnX; // agent spawn/starting x position
+		std::vector<float> spawnY; // agent spawn/starting y position
+		std::vector<AgentHandle> handle; // handle of the agent
+
 		/// <summary>
-		/// Agent constructor
+		/// Gets the number of agents
 		/// </summary>
-		/// <param name="teamId"></param>
-		/// <param name="pos"> spawn/start position</param>
-		/// <param name="health"> base/start health</param>
-		/// <param name="dir"> start direction in radians</param>
-		Agent(size_t teamId, Vec2 pos, float health, double dir);
+		size_t Size() const { return x.size(); }
 
 		/// <summary>
-		/// Agent destructor
+		/// Gets the position of an agent
 		/// </summary>
-		~Agent();
+		Vec2 Pos(size_t index) const { return Vec2(x[index], y[index]); }
+	};
 
-		size_t teamId; // team ID
-		Vec2 pos; // position
-		double dir; // direction in radians
-		float health; // agent health
-		size_t kills = 0;;
+	/// <summary>
+	/// An agent in the KD tree, the tree needs an object with a position to point to
+	/// </summary>
+	struct AgentPoint
+	{
+		Vec2 pos; // position of the agent, kept up to date while the tree is in use
+		size_t index; // index of the agent in the agent arrays
+	};
 
-		float reward = 0;
+	/// <summary>
+	/// Nearest hostile and friendly agents of a batch of agents, filled by FindAgentNeighbors
+	/// </summary>
+	struct NeighborBatch
+	{
+		size_t hostileK = 0; // hostile neighbors searched for per agent
+		size_t friendlyK = 0; // friendly neighbors searched for per agent
+		std::vector<KDTree<AgentPoint>::Neighbor> hostile; // hostileK slots per agent of the batch, nearest first
+		std::vector<KDTree<AgentPoint>::Neighbor> friendly; // friendlyK slots per agent of the batch, nearest first
+		std::vector<size_t> hostileCount; // hostile neighbors found per agent of the batch
+		std::vector<size_t> friendlyCount; // friendly neighbors found per agent of the batch
+		std::vector<uint64_t> order; // scratch, Morton code and position in the batch of each query, sorted
 
 		/// <summary>
-		/// update the position of the agent
+		/// Gets the hostile neighbors of the agent at a position in the batch
 		/// </summary>
-		/// <param name="delta">the duration of the update</param>
-		void UpdatePos(float delta);
+		const KDTree<AgentPoint>::Neighbor* Hostile(size_t query) const { return hostile.data() + query * hostileK; }
 
 		/// <summary>
-		/// Resets the agent to spawnPos and baseHealth
+		/// Gets the friendly neighbors of the agent at a position in the batch
 		/// </summary>
-		void Reset();
-
-		float baseHealth; // agent spawn/starting health
-		Vec2 spawnPos; // Agent spawn/starting position
+		const KDTree<AgentPoint>::Neighbor* Friendly(size_t query) const { return friendly.data() + query * friendlyK; }
+	};
 
-	private:
+	/// <summary>
+	/// KD tree over the agents of one team
+	/// </summary>
+	struct TeamTree
+	{
+		size_t team; // team ID of the agents in the tree
+		KDTree<AgentPoint> tree; // the team's agents
+	};
 
+	/// <summary>
+	/// Spatial index used for collisions and observation queries
+	/// </summary>
+	enum class Broadphase
+	{
+		Tree, // KD tree, copes with agents bunched together in a few places
+		Grid, // Uniform grid, rebuilt in O(n) without allocating, best when agents are spread out
 	};
 
-	std::mt19937& gen; // random number generator ref
+	uint64_t seed; // seed of the run
 	Vec2 simSize; // the size of the simulation, measured from center
 	bool wasReset = false;
 
-	std::list<Agent> agents; // list of all agents in the simulation
-	KDTree<Agent> kdTree; // KD tree used for collision optimization and by environment observations
+	AgentArrays agents; // all agents in the simulation
+	KDTree<AgentPoint> kdTree; // KD tree used for collision optimization and by environment observations, empty unless it is the broadphase
+	std::vector<TeamTree> teamTrees; // KD tree of each team in team order, used for friendly observation queries, empty unless the KD tree is the broadphase
+	SpatialGrid<AgentPoint> grid; // Grid used instead of the KD tree when it is the broadphase
+	ThreadPool* pool = &ThreadPool::Shared(); // Pool the engine splits its own work over, nullptr keeps it on the calling thread
+
+	/// <summary>
+	/// Gets the current index of an agent in the agent arrays
+	/// </summary>
+	/// <returns>index of the agent, noAgent if it was removed</returns>
+	size_t IndexOf(AgentHandle handle) const { return handleIndex[handle]; }
+
+	/// <summary>
+	/// Selects the spatial index and builds it
+	/// </summary>
+	void SetBroadphase(Broadphase newBroadphase);
+
+	/// <summary>
+	/// Gets the selected spatial index
+	/// </summary>
+	Broadphase GetBroadphase() const { return broadphase; }
+
+	/// <summary>
+	/// Finds the nearest agents to a position with the selected spatial index, writing them into a caller owned buffer
+	/// </summary>
+	/// <param name="query"> position to find agents near</param>
+	/// <param name="k"> the number of agents to be found, the capacity of the buffer</param>
+	/// <param name="neighbors"> filled with the agents, nearest first</param>
+	/// <param name="predicate"> called as predicate(const AgentPoint*), an agent must satisfy it to be returned</param>
+	/// <returns>number of agents found</returns>
+	template<typename Predicate>
+	size_t FindNearestNeighbors(const Vec2& query, size_t k, KDTree<AgentPoint>::Neighbor* neighbors, const Predicate& predicate) const
+	{
+		if (broadphase == Broadphase::Grid)
+		{
+			return grid.FindNearestNeighbors(query, k, neighbors, predicate);
+		}
+		return kdTree.FindNearestNeighbors(query, k, neighbors, predicate);
+	}
+
+	/// <summary>
+	/// Finds the nearest living hostile and friendly agents of an agent with the selected spatial index
+	/// </summary>
+	/// <remarks>
+	/// With the KD tree broadphase friendly agents are searched for in the tree of the agent's team only, and the hostile
+	/// search of the shared tree skips subtrees holding only the agent's team, so neither wades through agents it can not use
+	/// </remarks>
+	/// <param name="agent"> index of the agent, it is not its own friendly neighbor</param>
+	/// <param name="hostile"> filled with the nearest agents of other teams</param>
+	/// <param name="friendly"> filled with the nearest agents of the agent's team</param>
+	void FindAgentNeighbors(size_t agent, KDTree<AgentPoint>::NeighborSet& hostile, KDTree<AgentPoint>::NeighborSet& friendly) const;
+
+	/// <summary>
+	/// Finds the nearest living hostile and friendly agents of every agent of a batch
+	/// </summary>
+	/// <remarks>
+	/// The queries are sorted along a Morton curve so consecutive searches walk the same part of the spatial index
+	/// while it is in cache, and runs of them are split over the pool.
+	/// </remarks>
+	/// <param name="queryAgents"> indices of the agents, noAgent finds nothing</param>
+	/// <param name="hostileK"> the number of hostile agents to be found per agent</param>
+	/// <param name="friendlyK"> the number of friendly agents to be found per agent</param>
+	/// <param name="batch"> filled with the neighbors in the order of queryAgents, its storage is reused</param>
+	void FindAgentNeighbors(const std::vector<size_t>& queryAgents, size_t hostileK, size_t friendlyK, NeighborBatch& batch);
 
 	/// <summary>
 	/// Creates a new team of agents
@@ -87,7 +192,7 @@ public:
 	size_t AddTeam(size_t numAgents, float health, Vec2 pos);
 
 	/// <summary>
-	/// Removes all agents matching the given teamID
+	/// Removes all agents matching the given teamID, the other agents keep their order and handles
 	/// </summary>
 	void RemoveTeam(size_t teamID);
 
@@ -111,24 +216,84 @@ public:
 
 	static Color GenerateTeamColor(size_t teamID);
 private:
+	std::vector<size_t> handleIndex; // index of the agent of each handle, noAgent once removed
+	Broadphase broadphase = Broadphase::Tree;
+	std::vector<AgentPoint> spatialPoints; // agents in the spatial index, the index points into this array
+	std::vector<AgentPoint*> spatialPointers; // scratch array the spatial index is built from
 
 	/// <summary>
-	/// Updates the KD tree by rebuilding it
+	/// Two agents of different teams touching at the start of the collision stage
 	/// </summary>
-	void UpdateKDTree();
+	struct Contact
+	{
+		AgentPoint* a; // the agent with the lower index
+		AgentPoint* b; // the agent with the higher index
+
+		/// <summary>
+		/// Makes the contact of two agents, ordering them by index
+		/// </summary>
+		static Contact Between(AgentPoint* x, AgentPoint* y) { return x->index < y->index ? Contact{ x, y } : Contact{ y, x }; }
+	};
+
+	/// <summary>
+	/// Contacts found by one part of the collision stage, each part covers its own area
+	/// </summary>
+	struct CollisionPartition
+	{
+		std::vector<Contact> contacts; // contacts whose search started in the part's area
+		std::vector<AgentPoint*> inRange; // scratch array for the agents in range of a collision query
+	};
+
+	std::vector<CollisionPartition> collisionPartitions; // parts of the collision stage, kept so their storage is reused
+	std::vector<Contact> contacts; // contacts of every part, sorted before they are applied
+	std::vector<size_t> teamTreeStart; // scratch, first point of each team tree in spatialPointers, then the end of the last
+	bool teamGroupsExact = true; // whether every team has a group of its own in the KD tree, see TeamGroup
 
 	/// <summary>
-	/// Collision detection function built to make use of the KD tree
+	/// Gets the group of a team in the KD tree, teams 64 apart share a group
 	/// </summary>
-	/// <param name="node"></param>
-	void DoCollisions(KDTree<Agent>::KDNode* node);
+	static uint64_t TeamGroup(size_t team) { return uint64_t(1) << (team % 64); }
+
+	/// <summary>
+	/// Updates the spatial index of the selected broadphase by rebuilding it
+	/// </summary>
+	void UpdateSpatialIndex();
+
+	/// <summary>
+	/// Copies the agent positions into the spatial index points, the index is not rebuilt
+	/// </summary>
+	void SyncSpatialPoints();
+
+	/// <summary>
+	/// Collision stage, finds the contacts of the agents on the pool then applies them in order of their agents
+	/// </summary>
+	/// <remarks>
+	/// Contacts are found from the positions at the start of the stage, every pair of agents once, so the search has no
+	/// shared state to write and can be split by area. Applying them sorted gives the same result for any number of threads.
+	/// </remarks>
+	void DoCollisions();
+
+	/// <summary>
+	/// Finds the contacts of one part of the area with the selected spatial index
+	/// </summary>
+	/// <param name="partition"> the part to search</param>
+	/// <param name="partitionCount"> the number of parts the area is split into</param>
+	/// <param name="out"> receives the contacts, its previous contacts are cleared</param>
+	void FindContacts(size_t partition, size_t partitionCount, CollisionPartition& out) const;
 
 	/// <summary>
 	/// Collision function, used to define collision behavior
 	/// </summary>
-	/// <param name="agentA"></param>
-	/// <param name="agentB"></param>
-	void DoCollision(Agent* agentA, Agent* agentB);
+	/// <param name="pointA"></param>
+	/// <param name="pointB"></param>
+	void DoCollision(AgentPoint* pointA, AgentPoint* pointB);
+
+	/// <summary>
+	/// update the position of an agent
+	/// </summary>
+	/// <param name="index">index of the agent</param>
+	/// <param name="delta">the duration of the update</param>
+	void MoveAgent(size_t index, float delta);
 };
 
 
@@ -0,0 +1,28 @@
+#include "NeuralWarfareEngine.h"
+
+// Drawing is kept apart from the simulation so builds without a window, such as the headless runner, can leave it out
+
+extern float agentSize;
+
+void NeuralWarfareEngine::Draw(Rectangle drawRec)
+{
+    size_t lastTeamId = 0;
+    Color teamColor = GenerateTeamColor(lastTeamId);
+    Vec2 drawScale = Vec2(drawRec.width, drawRec.height) / simSize / 2;
+    Vec2 drawCenter(drawRec.x + drawRec.width / 2, drawRec.y + drawRec.height / 2);
+
+    for (size_t i = 0; i < agents.Size(); i++)
+    {
+        if (agents.health[i] <= 0)
+        {
+            continue;
+        }
+        if (agents.team[i] != lastTeamId)
+        {
+            lastTeamId = agents.team[i];
+            teamColor = GenerateTeamColor(lastTeamId);
+        }
+        Vec2 drawPos = drawCenter + agents.Pos(i) * drawScale;
+        DrawEllipse(drawPos.x, drawPos.y, agentSize * drawScale.x, agentSize * drawScale.y, teamColor);
+    }
+}
\ No newline at end of file
@@ -19,26 +19,56 @@ void NeuralWarfareEnv::TakeAction(std::list<Action*>& actions)
 {
 	for (Action* action : actions)
 	{
-		action->ExecuteAction(agents[action->ID]);
+		action->ExecuteAction(&engine.agents.dir[engine.IndexOf(agents[action->ID])]);
 	}
 }
 
 void NeuralWarfareEnv::SetTeamSpawnPos(Vec2 pos)
 {
-	for (NeuralWarfareEngine::Agent* agent : agents)
+	for (NeuralWarfareEngine::AgentHandle agent : agents)
 	{
-		agent->spawnPos = pos;
+		size_t index = engine.IndexOf(agent);
+		engine.agents.spawnX[index] = pos.x;
+		engine.agents.spawnY[index] = pos.y;
 	}
 }
 
-std::list<Environment::StepResult>* NeuralWarfareEnv::GetResult()
+void NeuralWarfareEnv::FindNeighbors()
 {
-	std::list<StepResult>* srts = new std::list<StepResult>();
-	for (size_t i = 0; i < agents.size(); i++)
+	agentIndices.clear();
+	for (NeuralWarfareEngine::AgentHandle agent : agents)
 	{
-		srts->emplace_back(getObservation(agents[i]), agents[i]->reward, agents[i]->health <= 0, engine.wasReset, i);
+		agentIndices.push_back(engine.IndexOf(agent));
+	}
+	engine.FindAgentNeighbors(agentIndices, MyObservation::hostileAgentCount, MyObservation::friendlyAgentCount, neighborBatch);
+}
+
+void NeuralWarfareEnv::GetResult(std::list<StepResult>& results)
+{
+	FindNeighbors();
+	if (results.size() != agents.size())
+	{
+		results.clear();
+		for (size_t i = 0; i < agents.size(); i++)
+		{
+			size_t index = agentIndices[i];
+			results.emplace_back(getObservation(index, i), engine.agents.reward[index], engine.agents.health[index] <= 0, engine.wasReset, i);
+		}
+		return;
+	}
+
+	// Same agents as the last call, refresh the existing results instead of allocating new ones
+	size_t i = 0;
+	for (StepResult& sr : results)
+	{
+		size_t index = agentIndices[i];
+		static_cast<MyObservation*>(sr.observation)->Observe(engine, index, neighborBatch, i);
+		sr.reward = engine.agents.reward[index];
+		sr.terminated = engine.agents.health[index] <= 0;
+		sr.truncated = engine.wasReset;
+		sr.ID = i;
+		i++;
 	}
-	return srts;
 }
 
 void NeuralWarfareEnv::Reset()
@@ -53,11 +83,11 @@ void NeuralWarfareEnv::Reset()
 void NeuralWarfareEnv::ConnectToTeam(size_t teamId)
 {
 	NeuralWarfareEnv::teamId = teamId;
-	for (NeuralWarfareEngine::Agent& agent : engine.agents)
+	for (size_t i = 0; i < engine.agents.Size(); i++)
 	{
-		if (agent.teamId == teamId)
+		if (engine.agents.team[i] == teamId)
 		{
-			agents.push_back(&agent);
+			agents.push_back(engine.agents.handle[i]);
 		}
 	}
 }
@@ -75,12 +105,13 @@ void NeuralWarfareEnv::UpdateKillTrackers()
 {
 	totalKillsThisEpisode = 0;
 	highestKillsThisEpisode = 0;
-	for (NeuralWarfareEngine::Agent* agent : agents)
+	for (NeuralWarfareEngine::AgentHandle agent : agents)
 	{
-		totalKillsThisEpisode += agent->kills;
-		if (agent->kills > highestKillsThisEpisode)
+		size_t kills = engine.agents.kills[engine.IndexOf(agent)];
+		totalKillsThisEpisode += kills;
+		if (kills > highestKillsThisEpisode)
 		{
-			highestKillsThisEpisode = agent->kills;
+			highestKillsThisEpisode = kills;
 		}
 	}
 }
@@ -106,49 +137,63 @@ size_t NeuralWarfareEnv::GetHighestKillsAllEpisodes()
 }
 
 
-Environment::Observation* NeuralWarfareEnv::getObservation(NeuralWarfareEngine::Agent* agent)
+Environment::Observation* NeuralWarfareEnv::getObservation(size_t agent, size_t query)
 {
-	MyObservation* observation = new MyObservation(engine,agent);
+	MyObservation* observation = new MyObservation(engine, NeuralWarfareEngine::noAgent);
+	observation->Observe(engine, agent, neighborBatch, query);
 
 
 	return observation;
 }
 
-NeuralWarfareEnv::MyObservation::MyObservation(NeuralWarfareEngine& engine, NeuralWarfareEngine::Agent* agent)
+NeuralWarfareEnv::MyObservation::MyObservation(NeuralWarfareEngine& engine, size_t agent)
+{
+	Observe(engine, agent);
+}
+
+void NeuralWarfareEnv::MyObservation::Observe(NeuralWarfareEngine& engine, size_t agent)
+{
+	if (agent == NeuralWarfareEngine::noAgent)
+	{
+		SetNeighbors(engine.agents, agent, nullptr, 0, nullptr, 0);
+		return;
+	}
+	// use the spatial index to find hostileAgents and friendlyAgents in one search
+	if (neighbors.size() < hostileAgentCount + friendlyAgentCount)
+	{
+		neighbors.resize(hostileAgentCount + friendlyAgentCount);
+	}
+	KDTree<NeuralWarfareEngine::AgentPoint>::NeighborSet hostile{ neighbors.data(), hostileAgentCount };
+	KDTree<NeuralWarfareEngine::AgentPoint>::NeighborSet friendly{ neighbors.data() + hostileAgentCount, friendlyAgentCount };
+	engine.FindAgentNeighbors(agent, hostile, friendly);
+	SetNeighbors(engine.agents, agent, hostile.neighbors, hostile.count, friendly.neighbors, friendly.count);
+}
+
+void NeuralWarfareEnv::MyObservation::Observe(NeuralWarfareEngine& engine, size_t agent, const NeuralWarfareEngine::NeighborBatch& batch, size_t query)
 {
-	if (agent)
+	SetNeighbors(engine.agents, agent, batch.Hostile(query), batch.hostileCount[query], batch.Friendly(query), batch.friendlyCount[query]);
+}
+
+void NeuralWarfareEnv::MyObservation::SetNeighbors(const NeuralWarfareEngine::AgentArrays& agents, size_t agent,
+	const KDTree<NeuralWarfareEngine::AgentPoint>::Neighbor* hostile, size_t hostileCount,
+	const KDTree<NeuralWarfareEngine::AgentPoint>::Neighbor* friendly, size_t friendlyCount)
+{
+	// clear keeps the capacity, so refreshing an observation does not allocate
+	hostileAgents.clear();
+	friendlyAgents.clear();
+	if (agent != NeuralWarfareEngine::noAgent)
 	{
-		if (hostileAgentCount)
+		const Vec2 pos = agents.Pos(agent);
+		for (size_t i = 0; i < hostileCount; i++)
 		{
-			// use KD tree to find hostileAgents
-			std::vector<NeuralWarfareEngine::Agent*> hostileAgentsVector =
-				engine.kdTree.FindNearestNeighbors(agent->pos, hostileAgentCount,
-					[agent](const NeuralWarfareEngine::Agent* a) {
-						return a->teamId != agent->teamId && a->health > 0;
-					}
-			);
-			for (NeuralWarfareEngine::Agent* hostileAgent : hostileAgentsVector)
-			{
-				hostileAgents.emplace_back(getRelativePolarPos(agent->pos, hostileAgent->pos, agent->dir));
-			}
+			hostileAgents.emplace_back(getRelativePolarPos(pos, hostile[i].object->pos, agents.dir[agent]));
 		}
-
-		if (friendlyAgentCount)
+		for (size_t i = 0; i < friendlyCount; i++)
 		{
-			// use KD tree to find friendlyAgents
-			std::vector<NeuralWarfareEngine::Agent*> friendlyAgentsVector =
-				engine.kdTree.FindNearestNeighbors(agent->pos, friendlyAgentCount,
-					[agent](const NeuralWarfareEngine::Agent* a) {
-						return a->teamId == agent->teamId && a != agent && a->health > 0;
-					}
-			);
-			for (NeuralWarfareEngine::Agent* friendlyAgent : friendlyAgentsVector)
-			{
-				friendlyAgents.emplace_back(getRelativePolarPos(agent->pos, friendlyAgent->pos, agent->dir));
-			}
+			friendlyAgents.emplace_back(getRelativePolarPos(pos, friendly[i].object->pos, agents.dir[agent]));
 		}
 
-		health = agent->health / agent->baseHealth;
+		health = agents.health[agent] / agents.baseHealth[agent];
 	}
 }
 
@@ -158,22 +203,23 @@ NeuralWarfareEnv::MyObservation::~MyObservation()
 	hostileAgents.clear();
 }
 
-std::vector<double> NeuralWarfareEnv::MyObservation::GetForNN()
+void NeuralWarfareEnv::MyObservation::GetForNN(double* inputs, size_t count)
 {
-	std::vector<double> out;
-
-	out.push_back(health);
-	for (size_t i = 0; i < friendlyAgents.size(); i++) 
+	// Same layout as before: health, then friendly and hostile agents, missing agents are left as 0
+	const size_t size = std::min(count, NNInputSize());
+	std::fill_n(inputs, size, 0.0);
+	size_t o = 0;
+	if (o < size) { inputs[o++] = health; }
+	for (size_t i = 0; i < friendlyAgents.size() && o + 1 < size; i++)
 	{
-		out.push_back(friendlyAgents[i].first);
-		out.push_back(friendlyAgents[i].second);
+		inputs[o++] = friendlyAgents[i].first;
+		inputs[o++] = friendlyAgents[i].second;
 	}
-	for (size_t i = 0; i < hostileAgents.size(); i++)
+	for (size_t i = 0; i < hostileAgents.size() && o + 1 < size; i++)
 	{
-		out.push_back(hostileAgents[i].first);
-		out.push_back(hostileAgents[i].second);
+		inputs[o++] = hostileAgents[i].first;
+		inputs[o++] = hostileAgents[i].second;
 	}
-	return out;
 }
 
 size_t NeuralWarfareEnv::MyObservation::NNInputSize()
@@ -188,14 +234,15 @@ double NeuralWarfareEnv::MyObservation::GetForTest()
 
 void NeuralWarfareEnv::MyAction::ExecuteAction(void* ptr)
 {
-	NeuralWarfareEngine::Agent* agent = static_cast<NeuralWarfareEngine::Agent*>(ptr);
+	// The environment passes the direction of the agent, the only state an action changes
+	double* dir = static_cast<double*>(ptr);
 	switch (action)
 	{
 	case 1:
-		agent->dir += 0.2;
+		*dir += 0.2;
 		break;
 	case 2:
-		agent->dir += -0.2;
+		*dir += -0.2;
 	default:
 		break;
 	}
@@ -209,17 +256,17 @@ NeuralWarfareEnv::MyAction::MyAction(size_t ID) : Action(ID)
 {
 }
 
-void NeuralWarfareEnv::MyAction::GetFromNN(std::vector<double> outputs)
+void NeuralWarfareEnv::MyAction::GetFromNN(const double* outputs, size_t count)
 {
 	double totalSpread = 0.0;
 
 	// Calculate sum of absolute differences
-	for (size_t i = 1; i < outputs.size(); ++i) {
+	for (size_t i = 1; i < count; ++i) {
 		totalSpread += std::abs(outputs[i] - outputs[i - 1]);
 	}
 
 	// Calculate average difference
-	double averageSpread = totalSpread / (outputs.size() - 1);
+	double averageSpread = totalSpread / (count - 1);
 
 	if (averageSpread < 0.2)
 	{
@@ -228,7 +275,7 @@ void NeuralWarfareEnv::MyAction::GetFromNN(std::vector<double> outputs)
 	}
 
 	double maxValue = 0;
-	for (size_t i = 0; i < outputs.size(); i++)
+	for (size_t i = 0; i < count; i++)
 	{
 		if (maxValue < outputs[i])
 		{
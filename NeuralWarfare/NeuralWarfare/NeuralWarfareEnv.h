@@ -28,11 +28,13 @@ public:
 
 	void SetTeamSpawnPos(Vec2 pos);
 
+	using Environment::GetResult;
+
 	/// <summary>
-	/// Function to get the result of the last action preformed
+	/// Function to get the result of the last action preformed into an existing list
 	/// </summary>
-	/// <returns>array of StepResult from the last taken action</returns>
-	std::list<StepResult>* GetResult() override;
+	/// <param name="results"> array of StepResult from the last taken action, observations from an earlier call are refreshed in place</param>
+	void GetResult(std::list<StepResult>& results) override;
 
 	/// <summary>
 	/// Function to reset the environment
@@ -40,7 +42,7 @@ public:
 	/// <returns>array of StepResult from the reset state of the Environment</returns>
 	void Reset() override;
 
-	static class MyAction : public Action
+	class MyAction : public Action
 	{
 	public:
 		/// <summary>
@@ -56,7 +58,9 @@ public:
 		/// <param name="action"></param>
 		MyAction(size_t ID);
 
-		void GetFromNN(std::vector<double> outputs) override;
+		using Action::GetFromNN;
+
+		void GetFromNN(const double* outputs, size_t count) override;
 
 		size_t NNOutputSize() override;
 
@@ -71,16 +75,39 @@ public:
 	/// <summary>
 	/// Stores information for an AI to use to decide its next action.
 	/// </summary>
-	static class MyObservation : public Observation
+	class MyObservation : public Observation
 	{
 	public:
-		MyObservation(NeuralWarfareEngine& eng, NeuralWarfareEngine::Agent* agent);
+		/// <summary>
+		/// MyObservation constructor
+		/// </summary>
+		/// <param name="eng"> the game engine</param>
+		/// <param name="agent"> index of the observing agent, noAgent leaves the observation empty</param>
+		MyObservation(NeuralWarfareEngine& eng, size_t agent);
 		~MyObservation() override;
+		/// <summary>
+		/// Refreshes the observation for the current state of an agent, reusing the storage of the last observation.
+		/// </summary>
+		/// <param name="eng"> the game engine, its spatial index is used to find the nearest agents</param>
+		/// <param name="agent"> index of the observing agent, noAgent leaves the observation empty</param>
+		void Observe(NeuralWarfareEngine& eng, size_t agent);
+		/// <summary>
+		/// Refreshes the observation from a batched neighbor query, reusing the storage of the last observation.
+		/// </summary>
+		/// <param name="eng"> the game engine</param>
+		/// <param name="agent"> index of the observing agent, noAgent leaves the observation empty</param>
+		/// <param name="batch"> neighbors found for the agent by NeuralWarfareEngine::FindAgentNeighbors</param>
+		/// <param name="query"> position of the agent in the batch</param>
+		void Observe(NeuralWarfareEngine& eng, size_t agent, const NeuralWarfareEngine::NeighborBatch& batch, size_t query);
+
+		using Observation::GetForNN;
+
 		/// <summary>
 		/// Converts the information for use by a neural network.
 		/// </summary>
-		/// <returns>The inputs for a neural network</returns>
-		std::vector<double> GetForNN() override;
+		/// <param name="inputs"> buffer for the inputs of a neural network</param>
+		/// <param name="count"> size of the buffer</param>
+		void GetForNN(double* inputs, size_t count) override;
 
 		size_t NNInputSize() override;
 
@@ -93,6 +120,14 @@ public:
 		static size_t hostileAgentCount;
 		static size_t friendlyAgentCount;
 	private:
+		std::vector<KDTree<NeuralWarfareEngine::AgentPoint>::Neighbor> neighbors; // Scratch buffer for the spatial index queries, only grows
+
+		/// <summary>
+		/// Fills the observation with the positions of the neighbors found for an agent
+		/// </summary>
+		void SetNeighbors(const NeuralWarfareEngine::AgentArrays& agents, size_t agent,
+			const KDTree<NeuralWarfareEngine::AgentPoint>::Neighbor* hostile, size_t hostileCount,
+			const KDTree<NeuralWarfareEngine::AgentPoint>::Neighbor* friendly, size_t friendlyCount);
 
 	};
 	size_t teamId; // The team ID of the agents connected the environment
@@ -112,14 +147,22 @@ private:
 	size_t highestKillsPastEpisodes = 0;
 
 	NeuralWarfareEngine& engine; // Reference the game engine
-	std::vector<NeuralWarfareEngine::Agent*> agents; // array of pointers that this environment is training
+	std::vector<NeuralWarfareEngine::AgentHandle> agents; // handles of the agents this environment is training
+	std::vector<size_t> agentIndices; // scratch, current index of each agent, the queries of the neighbor batch
+	NeuralWarfareEngine::NeighborBatch neighborBatch; // neighbors of every agent, found together before observing
+
+	/// <summary>
+	/// Finds the neighbors of every agent of the environment into neighborBatch
+	/// </summary>
+	void FindNeighbors();
 
 	/// <summary>
 	/// Gets the observation for a specific agent
 	/// </summary>
-	/// <param name="agent"></param>
+	/// <param name="agent"> index of the agent</param>
+	/// <param name="query"> position of the agent in neighborBatch</param>
 	/// <returns>observation for a specific agent</returns>
-	Observation* getObservation(NeuralWarfareEngine::Agent* agent);
+	Observation* getObservation(size_t agent, size_t query);
 
 	/// <summary>
 	/// function to connect the Environment to a team in the engine
@@ -1,8 +1,32 @@
 #include "NeuralWarfareTrainers.h"
+#include "CompiledNetwork.h"
 #include <algorithm>
 #include "tinyxml2.h"
 #include "SimpleMutate.h"
 #include <iostream>
+
+/// <summary>
+/// Writes the neural network inputs of every step result into a row major matrix, one row per agent ID
+/// </summary>
+/// <param name="results"> step results to read the observations from</param>
+/// <param name="matrix"> matrix to fill, missing values are left as 0</param>
+/// <param name="stride"> set to the number of values in each row</param>
+static void FillObservationMatrix(std::list<Environment::StepResult>& results, std::vector<double>& matrix, size_t& stride)
+{
+	size_t rows = 0;
+	stride = 0;
+	for (Environment::StepResult& sr : results)
+	{
+		rows = std::max(rows, sr.ID + 1);
+		stride = std::max(stride, sr.observation->NNInputSize());
+	}
+	matrix.assign(rows * stride, 0);
+	for (Environment::StepResult& sr : results)
+	{
+		sr.observation->GetForNN(matrix.data() + sr.ID * stride, stride);
+	}
+}
+
 TestTrainer::TestTrainer(Environment* env) : Trainer(env)
 {
 
@@ -17,7 +41,7 @@ void TestTrainer::Update()
 {
 	if (LastStepResults)
 	{
-		nextActions = new std::list<Environment::Action*>();
+		BeginActions();
 		bool allTruncated = true;
 		for (Environment::StepResult& sr : *LastStepResults)
 		{
@@ -29,9 +53,8 @@ void TestTrainer::Update()
 		}
 		for (Environment::StepResult& sr : *LastStepResults)
 		{
-			Environment::Action* action = new NeuralWarfareEnv::MyAction(sr);
+			Environment::Action* action = NewAction<NeuralWarfareEnv::MyAction>(sr);
 			action->GetFromTest(sr.observation->GetForTest());
-			nextActions->push_back(action);
 		}
 	}
 }
@@ -50,7 +73,7 @@ void StaticNNTrainer::Update()
 {
 	if (LastStepResults)
 	{
-		nextActions = new std::list<Environment::Action*>();
+		BeginActions();
 		bool allTruncated = true;
 		for (Environment::StepResult& sr : *LastStepResults)
 		{
@@ -61,20 +84,27 @@ void StaticNNTrainer::Update()
 			env->Reset();
 		}
 
+		agentNetworks.assign(LastStepResults->size(), network);
+		size_t inputStride = 0;
+		size_t outputStride = network->GetPlan()->OutputCount();
+		FillObservationMatrix(*LastStepResults, observationMatrix, inputStride);
+		actionMatrix.resize(agentNetworks.size() * outputStride);
+		evaluator.Evaluate(agentNetworks, observationMatrix.data(), inputStride, actionMatrix.data(), outputStride, pool);
+
 		for (Environment::StepResult& sr : *LastStepResults)
 		{
-			Environment::Action* action = new NeuralWarfareEnv::MyAction(sr);
+			Environment::Action* action = NewAction<NeuralWarfareEnv::MyAction>(sr);
 			if (!(sr.terminated))
 			{
-				action->GetFromNN(network->Evaluate(sr.observation->GetForNN()));
+				action->GetFromNN(actionMatrix.data() + sr.ID * outputStride, outputStride);
 			}
-			nextActions->push_back(action);
 		}
 	}
 }
 
-GeneticAlgorithmNNTrainer::GeneticAlgorithmNNTrainer(Environment* env, std::mt19937& gen, MyHyperparameters hyperparameters, NeuralNetwork* masterNetwork) :  Trainer(env), gen(gen), hyperparameters(hyperparameters), masterNetwork(masterNetwork)
+GeneticAlgorithmNNTrainer::GeneticAlgorithmNNTrainer(Environment* env, uint64_t seed, MyHyperparameters hyperparameters, NeuralNetwork* masterNetwork) : Trainer(env), masterNetwork(masterNetwork), hyperparameters(hyperparameters), seed(seed)
 {
+	masterNetwork->SetPrecision(hyperparameters.precision);
 	agents.push_back(new Agent(masterNetwork));
 }
 
@@ -95,7 +125,7 @@ void GeneticAlgorithmNNTrainer::Update()
 		{
 			agents.push_back(new Agent { NeuralNetwork::Copy(masterNetwork) });
 		}
-		nextActions = new std::list<Environment::Action*>();
+		BeginActions();
 		bool allTruncated = true;
 		for (Environment::StepResult& sr : *LastStepResults)
 		{
@@ -107,14 +137,26 @@ void GeneticAlgorithmNNTrainer::Update()
 			Evolve();
 			env->Reset();
 		}
+		agentNetworks.resize(agents.size());
+		size_t outputStride = 0;
+		for (size_t i = 0; i < agents.size(); i++)
+		{
+			agentNetworks[i] = agents[i]->network;
+			outputStride = std::max(outputStride, agentNetworks[i]->GetPlan()->OutputCount());
+		}
+		size_t inputStride = 0;
+		FillObservationMatrix(*LastStepResults, observationMatrix, inputStride);
+		observationMatrix.resize(agentNetworks.size() * inputStride);
+		actionMatrix.resize(agentNetworks.size() * outputStride);
+		evaluator.Evaluate(agentNetworks, observationMatrix.data(), inputStride, actionMatrix.data(), outputStride, pool);
+
 		for (Environment::StepResult& sr : *LastStepResults)
 		{
-			Environment::Action* action = new NeuralWarfareEnv::MyAction(sr);
+			Environment::Action* action = NewAction<NeuralWarfareEnv::MyAction>(sr);
 			if (!(sr.terminated))
 			{
-				action->GetFromNN(agents[sr.ID]->network->Evaluate(sr.observation->GetForNN()));
+				action->GetFromNN(actionMatrix.data() + sr.ID * outputStride, agentNetworks[sr.ID]->GetPlan()->OutputCount());
 			}
-			nextActions->push_back(action);
 		}
 	}
 }
@@ -138,37 +180,51 @@ void GeneticAlgorithmNNTrainer::Evolve()
 	std::vector<Agent*>::iterator topAgentsEnd = agents.begin() + hyperparameters.topAgentCount;
 	std::partial_sort(agents.begin(), topAgentsEnd, agents.end(), [](Agent* a, Agent* b) { return a->fitness > b->fitness; });
 	masterNetwork = agents.front()->network;
+
+	// The elites are only read while offspring are built, compiling their plans first keeps Copy from modifying them
+	for (std::vector<Agent*>::iterator topAgentsIter = agents.begin(); topAgentsIter != topAgentsEnd; topAgentsIter++)
 	{
-		std::vector<Agent*>::iterator otherAgentsIter = topAgentsEnd;
-		std::vector<Agent*>::iterator topAgentsIter = agents.begin();
-		while (otherAgentsIter != agents.end())
-		{
-			if (topAgentsIter == topAgentsEnd) { topAgentsIter = agents.begin(); }
-			(*otherAgentsIter)->SetNetwork(NeuralNetwork::Copy((*topAgentsIter)->network));
+		(*topAgentsIter)->network->GetPlan();
+	}
 
-			for (size_t i = 0; i < hyperparameters.mutationCount; i++)
+	// Each offspring draws from its own stream, so the result is the same however the offspring are spread over threads
+	const size_t offspringCount = agents.size() - hyperparameters.topAgentCount;
+	pool->ParallelFor(offspringCount, 1, [this](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
 			{
-				SimpleMutate(
-					(*otherAgentsIter)->network,
-					gen,
-					hyperparameters.biasMutationRate,
-					hyperparameters.biasMutationMagnitude,
-					hyperparameters.weightMutationRate,
-					hyperparameters.weightMutationMagnitude,
-					hyperparameters.synapseMutationRate,
-					hyperparameters.newSynapseMagnitude,
-					hyperparameters.nodeMutationRate,
-					hyperparameters.layerMutationRate,
-					hyperparameters.newLayerSizeAverage,
-					hyperparameters.newLayerSizeRange,
-					newLayerFunction
-					);
+				MakeOffspring(i);
 			}
-			(*otherAgentsIter)->network->Clean();
-			otherAgentsIter++;
-			topAgentsIter++;
-		}
+		});
+	generation++;
+}
+
+void GeneticAlgorithmNNTrainer::MakeOffspring(size_t offspring)
+{
+	Agent* parent = agents[offspring % hyperparameters.topAgentCount];
+	Agent* child = agents[hyperparameters.topAgentCount + offspring];
+	child->SetNetwork(NeuralNetwork::Copy(parent->network));
+
+	RandomStream offspringGen(seed, generation, static_cast<uint32_t>(offspring), RandomPurpose::Mutation);
+	for (size_t i = 0; i < hyperparameters.mutationCount; i++)
+	{
+		SimpleMutate(
+			child->network,
+			offspringGen,
+			hyperparameters.biasMutationRate,
+			hyperparameters.biasMutationMagnitude,
+			hyperparameters.weightMutationRate,
+			hyperparameters.weightMutationMagnitude,
+			hyperparameters.synapseMutationRate,
+			hyperparameters.newSynapseMagnitude,
+			hyperparameters.nodeMutationRate,
+			hyperparameters.layerMutationRate,
+			hyperparameters.newLayerSizeAverage,
+			hyperparameters.newLayerSizeRange,
+			newLayerFunction
+			);
 	}
+	child->network->Clean();
 }
 
 void GeneticAlgorithmNNTrainer::MyHyperparameters::Load(std::string fileName)
@@ -214,6 +270,13 @@ void GeneticAlgorithmNNTrainer::MyHyperparameters::Load(std::string fileName)
 		std::cerr << "ERROR: Failed to load hyperparameter 'newLayerSizeRange' TinyXMLError[" << e << "] = " << tinyxml2::XMLDocument::ErrorIDToName(e) << std::endl;
 
 	newLayerFunction = root->Attribute("newLayerFunction");
+
+	// Files written before the precision was added evaluate in double precision
+	if (const char* precisionName = root->Attribute("precision"))
+	{
+		if (!ParsePrecision(precisionName, precision))
+			std::cerr << "ERROR: Unknown precision '" << precisionName << "' in hyperparameter 'precision'" << std::endl;
+	}
 }
 
 void GeneticAlgorithmNNTrainer::MyHyperparameters::Save(std::string fileName)
@@ -242,6 +305,7 @@ void GeneticAlgorithmNNTrainer::MyHyperparameters::Save(std::string fileName)
 	root->SetAttribute("newLayerSizeAverage", newLayerSizeAverage);
 	root->SetAttribute("newLayerSizeRange", newLayerSizeRange);
 	root->SetAttribute("newLayerFunction", newLayerFunction.c_str());
+	root->SetAttribute("precision", PrecisionName(precision));
 
 	// Save to file
 	doc.SaveFile(fileName.c_str());
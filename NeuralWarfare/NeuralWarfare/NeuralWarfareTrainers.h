@@ -3,6 +3,7 @@
 #include "Trainer.h"
 #include "NeuralWarfareEnv.h"
 #include "NeuralNetwork.h"
+#include "PopulationEvaluator.h"
 
 class TestTrainer : public Trainer
 {
@@ -23,12 +24,16 @@ public:
 
 private:
 	NeuralNetwork* network;
+	PopulationEvaluator evaluator; // Evaluates the network for every agent in one pass
+	std::vector<NeuralNetwork*> agentNetworks; // The network used by each agent, all the same network
+	std::vector<double> observationMatrix; // Observation of each agent, one row per agent
+	std::vector<double> actionMatrix; // Network outputs of each agent, one row per agent
 };
 
 class GeneticAlgorithmNNTrainer : public Trainer
 {
 public:
-	static class MyHyperparameters : Hyperparameters
+	class MyHyperparameters : Hyperparameters
 	{
 	public:
 		MyHyperparameters(std::string fileName) : newLayerFunction(newLayerFunction)
@@ -92,15 +97,25 @@ public:
 		int newLayerSizeAverage;
 		int newLayerSizeRange; 
 		std::string newLayerFunction;
+		Precision precision = Precision::Float64; // Precision the master network and its offspring are evaluated in.
 
 	private:
 
 	};
 
-	GeneticAlgorithmNNTrainer(Environment* env, std::mt19937& gen, MyHyperparameters hyperparameters, NeuralNetwork* masterNetwork);
+	/// <summary>
+	/// GeneticAlgorithmNNTrainer constructor
+	/// </summary>
+	/// <param name="seed">Seed of the trainer's random streams, trainers sharing a run should be given different seeds.</param>
+	GeneticAlgorithmNNTrainer(Environment* env, uint64_t seed, MyHyperparameters hyperparameters, NeuralNetwork* masterNetwork);
 	~GeneticAlgorithmNNTrainer() override;
 	void Update() override;
 
+	/// <summary>
+	/// Gets the number of generations evolved so far.
+	/// </summary>
+	uint32_t GetGeneration() const { return generation; }
+
 	NeuralNetwork* masterNetwork;
 	MyHyperparameters hyperparameters;
 private:
@@ -109,7 +124,13 @@ private:
 
 	void Evolve();
 
-	static class Agent
+	/// <summary>
+	/// Replaces the network of a non elite agent with a mutated copy of an elite, using the random stream of the offspring in the current generation.
+	/// </summary>
+	/// <param name="offspring">Index of the agent among the non elite agents.</param>
+	void MakeOffspring(size_t offspring);
+
+	class Agent
 	{
 	public:
 		Agent(NeuralNetwork* network);
@@ -123,5 +144,11 @@ private:
 
 	ActivationFunction* newLayerFunction = nullptr;
 	std::vector<Agent*> agents;
-	std::mt19937& gen;
+	uint64_t seed; // Key of the trainer's random streams
+	uint32_t generation = 0; // Number of generations evolved, selects the streams of the next generation
+
+	PopulationEvaluator evaluator; // Evaluates every agent's network in one pass
+	std::vector<NeuralNetwork*> agentNetworks; // The network of each agent, indexed by agent ID
+	std::vector<double> observationMatrix; // Observation of each agent, one row per agent
+	std::vector<double> actionMatrix; // Network outputs of each agent, one row per agent
 };
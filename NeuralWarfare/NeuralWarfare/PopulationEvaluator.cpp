@@ -0,0 +1,234 @@
+#include "PopulationEvaluator.h"
+#include "NeuralNetwork.h"
+#include "CompiledNetwork.h"
+#include "DenseKernels.h"
+#include "ThreadPool.h"
+#include <unordered_map>
+#include <algorithm>
+
+void PopulationEvaluator::Evaluate(const std::vector<NeuralNetwork*>& networks, const double* observations, size_t inputStride, double* actions, size_t outputStride, ThreadPool* pool)
+{
+	plans.resize(networks.size());
+	bool changed = planIds.size() != networks.size();
+	for (size_t i = 0; i < networks.size(); i++)
+	{
+		plans[i] = networks[i]->GetPlan();
+		if (!changed && plans[i]->id != planIds[i])
+		{
+			changed = true;
+		}
+	}
+
+	if (changed)
+	{
+		BuildGroups(networks, plans);
+	}
+
+	// Groups write disjoint rows of actions, and a plan shared by several groups only has its values written back by one of them,
+	// so the groups can be evaluated side by side
+	auto evaluateGroups = [&](size_t begin, size_t end)
+		{
+			for (size_t g = begin; g < end; g++)
+			{
+				EvaluateGroup(groups[g], observations, inputStride, actions, outputStride);
+			}
+		};
+	if (pool)
+	{
+		pool->ParallelFor(groups.size(), 1, evaluateGroups);
+	}
+	else
+	{
+		evaluateGroups(0, groups.size());
+	}
+}
+
+void PopulationEvaluator::BuildGroups(const std::vector<NeuralNetwork*>& networks, const std::vector<CompiledNetwork*>& plans)
+{
+	groups.clear();
+	planIds.resize(networks.size());
+
+	std::unordered_map<uint64_t, std::vector<size_t>> groupsByHash;
+	for (size_t i = 0; i < plans.size(); i++)
+	{
+		planIds[i] = plans[i]->id;
+
+		std::vector<size_t>& candidates = groupsByHash[plans[i]->topologyHash];
+		size_t groupIndex = groups.size();
+		for (size_t candidate : candidates)
+		{
+			if (groups[candidate].members.size() < maxGroupSize && groups[candidate].shape->SameTopology(*plans[i]))
+			{
+				groupIndex = candidate;
+				break;
+			}
+		}
+		if (groupIndex == groups.size())
+		{
+			candidates.push_back(groupIndex);
+			groups.emplace_back();
+			groups.back().shape = plans[i];
+		}
+		groups[groupIndex].members.push_back(i);
+		groups[groupIndex].memberPlans.push_back(plans[i]);
+	}
+
+	// A network driving several agents can span groups, the last of its members writes its plan's values back
+	std::unordered_map<CompiledNetwork*, std::pair<size_t, size_t>> valueWriter;
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		groups[g].valueWriters.clear();
+		for (size_t m = 0; m < groups[g].memberPlans.size(); m++)
+		{
+			valueWriter[groups[g].memberPlans[m]] = { g, m };
+		}
+	}
+	for (const std::pair<CompiledNetwork* const, std::pair<size_t, size_t>>& writer : valueWriter)
+	{
+		groups[writer.second.first].valueWriters.push_back(writer.second.second);
+	}
+
+	for (Group& group : groups)
+	{
+		std::sort(group.valueWriters.begin(), group.valueWriters.end());
+		if (group.shape->precision == Precision::Float32)
+		{
+			PackGroup(group, group.float32);
+		}
+		else
+		{
+			PackGroup(group, group.float64);
+		}
+	}
+}
+
+template<typename T>
+void PopulationEvaluator::PackGroup(Group& group, PackedParameters<T>& packed)
+{
+	// Interleave the parameters of the group so the members of one node or synapse are contiguous
+	const size_t memberCount = group.members.size();
+	const size_t nodeCount = group.shape->NodeCount();
+	const size_t synapseCount = group.shape->SynapseCount();
+	const PlanTopology& topology = group.shape->Topology();
+	const PlanParameters<T>& shapeParameters = group.shape->Parameters<T>();
+	packed.bias.resize(nodeCount * memberCount);
+	packed.values.resize(nodeCount * memberCount);
+	packed.preActivation.resize(nodeCount * memberCount);
+	group.sharedWeights = true;
+	for (size_t m = 0; m < memberCount; m++)
+	{
+		const PlanParameters<T>& parameters = group.memberPlans[m]->Parameters<T>();
+		// Plans forked from the same parent compare their untouched blocks by pointer
+		if (parameters.bias != shapeParameters.bias || parameters.synapseWeight != shapeParameters.synapseWeight)
+		{
+			group.sharedWeights = false;
+		}
+		for (size_t l = 0; l < parameters.bias.BlockCount(); l++)
+		{
+			const T* bias = parameters.bias.Block(l);
+			for (uint32_t n = topology.layerStart[l]; n < topology.layerStart[l + 1]; n++)
+			{
+				packed.bias[n * memberCount + m] = bias[n - topology.layerStart[l]];
+			}
+		}
+		for (size_t n = 0; n < nodeCount; n++)
+		{
+			packed.values[n * memberCount + m] = parameters.values[n];
+		}
+	}
+
+	// Members with shared weights read the shape's weights directly
+	packed.weight.clear();
+	if (!group.sharedWeights)
+	{
+		packed.weight.resize(synapseCount * memberCount);
+		for (size_t m = 0; m < memberCount; m++)
+		{
+			const PlanParameters<T>& parameters = group.memberPlans[m]->Parameters<T>();
+			for (size_t l = 0; l < parameters.synapseWeight.BlockCount(); l++)
+			{
+				const T* weight = parameters.synapseWeight.Block(l);
+				for (uint32_t s = topology.layerSynapseStart[l]; s < topology.layerSynapseStart[l + 1]; s++)
+				{
+					packed.weight[s * memberCount + m] = weight[s - topology.layerSynapseStart[l]];
+				}
+			}
+		}
+	}
+}
+
+void PopulationEvaluator::EvaluateGroup(Group& group, const double* observations, size_t inputStride, double* actions, size_t outputStride)
+{
+	if (group.shape->precision == Precision::Float32)
+	{
+		EvaluateGroupAs(group, group.float32, observations, inputStride, actions, outputStride);
+	}
+	else
+	{
+		EvaluateGroupAs(group, group.float64, observations, inputStride, actions, outputStride);
+	}
+}
+
+template<typename T>
+void PopulationEvaluator::EvaluateGroupAs(Group& group, PackedParameters<T>& packed, const double* observations, size_t inputStride, double* actions, size_t outputStride)
+{
+	const CompiledNetwork& shape = *group.shape;
+	const PlanTopology& topology = shape.Topology();
+	const size_t memberCount = group.members.size();
+	const size_t nodeCount = shape.NodeCount();
+	T* pre = packed.preActivation.data();
+	T* values = packed.values.data();
+	const T* weight = packed.weight.data();
+
+	std::copy(packed.bias.begin(), packed.bias.end(), packed.preActivation.begin());
+
+	const size_t inputCount = std::min(inputStride, shape.InputCount());
+	for (size_t i = 0; i < inputCount; i++)
+	{
+		T* nodePre = pre + topology.inputIndex[i] * memberCount;
+		for (size_t m = 0; m < memberCount; m++)
+		{
+			nodePre[m] += static_cast<T>(observations[group.members[m] * inputStride + i]);
+		}
+	}
+
+	if (group.sharedWeights)
+	{
+		shape.EvaluateInterleaved(pre, values, memberCount);
+	}
+	else
+	{
+		for (size_t l = 0; l < shape.LayerCount(); l++)
+		{
+			for (uint32_t n = topology.layerStart[l]; n < topology.layerStart[l + 1]; n++)
+			{
+				T* nodePre = pre + n * memberCount;
+				for (uint32_t s = topology.synapseStart[n]; s < topology.synapseStart[n + 1]; s++)
+				{
+					VectorMultiplyAdd(values + topology.synapseSource[s] * memberCount, weight + s * memberCount, nodePre, memberCount);
+				}
+			}
+			shape.ActivateLayer(l, pre, values, memberCount);
+		}
+	}
+
+	const size_t outputCount = std::min(outputStride, shape.OutputCount());
+	for (size_t m = 0; m < memberCount; m++)
+	{
+		double* row = actions + group.members[m] * outputStride;
+		for (size_t o = 0; o < outputCount; o++)
+		{
+			row[o] = values[topology.outputIndex[o] * memberCount + m];
+		}
+	}
+
+	// Keep each plan's values current so backwards synapses and the network visualizer see this evaluation
+	for (size_t m : group.valueWriters)
+	{
+		std::vector<T>& planValues = group.memberPlans[m]->Parameters<T>().values;
+		for (size_t n = 0; n < nodeCount; n++)
+		{
+			planValues[n] = values[n * memberCount + m];
+		}
+	}
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class NeuralNetwork;
+class CompiledNetwork;
+class ThreadPool;
+
+/// <summary>
+/// Evaluates a whole population of neural networks in one pass.
+/// </summary>
+/// <remarks>
+/// Networks whose compiled plans share a topology are grouped together. The bias, weight and value
+/// arrays of a group are interleaved so each node is computed for every member of the group in one
+/// contiguous inner loop. Groups whose members all carry the same parameters, such as many agents
+/// driven by one network, are evaluated through the plan's batched matrix-matrix path instead. Groups and packed weights are cached and only rebuilt when a network in
+/// the population is swapped or recompiled, so steady state evaluation does no allocation.
+/// Single precision networks are only grouped with each other and packed as floats.
+/// </remarks>
+class PopulationEvaluator
+{
+public:
+	/// <summary>
+	/// PopulationEvaluator constructor
+	/// </summary>
+	PopulationEvaluator() {};
+
+	/// <summary>
+	/// PopulationEvaluator destructor
+	/// </summary>
+	~PopulationEvaluator() {};
+
+	/// <summary>
+	/// Evaluates every network against its row of the observation matrix.
+	/// </summary>
+	/// <param name="networks">The network of each agent, the same network may appear more than once.</param>
+	/// <param name="observations">Row major observation matrix with one row per network.</param>
+	/// <param name="inputStride">Number of values in each observation row.</param>
+	/// <param name="actions">Row major output matrix with one row per network.</param>
+	/// <param name="outputStride">Number of values in each output row.</param>
+	/// <param name="pool">Pool to evaluate the groups on as separate tasks, nullptr evaluates them on the calling thread.</param>
+	void Evaluate(const std::vector<NeuralNetwork*>& networks, const double* observations, size_t inputStride, double* actions, size_t outputStride, ThreadPool* pool = nullptr);
+
+	/// <summary>
+	/// Gets the number of topology groups the population was split into by the last evaluation.
+	/// </summary>
+	size_t GroupCount() const { return groups.size(); }
+
+private:
+	/// <summary>
+	/// Parameters of a group in one precision, interleaved as [node or synapse][member].
+	/// </summary>
+	template<typename T>
+	struct PackedParameters
+	{
+		std::vector<T> bias; // Interleaved bias of each node.
+		std::vector<T> weight; // Interleaved weight of each synapse, empty when the members share their weights.
+		std::vector<T> values; // Interleaved value of each node.
+		std::vector<T> preActivation; // Interleaved summed input of each node.
+	};
+
+	/// <summary>
+	/// Networks sharing a topology and precision, with their parameters interleaved as [node or synapse][member].
+	/// </summary>
+	struct Group
+	{
+		CompiledNetwork* shape; // Plan of the first member, used for the shared topology arrays.
+		std::vector<size_t> members; // Index of each member in the population.
+		std::vector<CompiledNetwork*> memberPlans; // Plan of each member.
+		std::vector<size_t> valueWriters; // Members whose node values are copied back to their plan, every plan of the population has exactly one writer.
+		bool sharedWeights = false; // True if every member has the same bias and weights, so dense layers can be evaluated as one matrix product.
+		PackedParameters<double> float64; // Packed parameters of a double precision group.
+		PackedParameters<float> float32; // Packed parameters of a single precision group.
+	};
+
+	static constexpr size_t maxGroupSize = 32; // Members of a group, larger topology groups are split so the chunks can be evaluated on separate threads.
+
+	std::vector<Group> groups; // Topology groups of the population.
+	std::vector<uint64_t> planIds; // Id of each network's plan when the groups were built.
+
+	/// <summary>
+	/// Splits the population into topology groups and packs their parameters.
+	/// </summary>
+	void BuildGroups(const std::vector<NeuralNetwork*>& networks, const std::vector<CompiledNetwork*>& plans);
+
+	/// <summary>
+	/// Evaluates one group.
+	/// </summary>
+	void EvaluateGroup(Group& group, const double* observations, size_t inputStride, double* actions, size_t outputStride);
+
+	/// <summary>
+	/// Packs the parameters of a group in precision T.
+	/// </summary>
+	template<typename T>
+	void PackGroup(Group& group, PackedParameters<T>& packed);
+
+	/// <summary>
+	/// Evaluates one group in precision T.
+	/// </summary>
+	template<typename T>
+	void EvaluateGroupAs(Group& group, PackedParameters<T>& packed, const double* observations, size_t inputStride, double* actions, size_t outputStride);
+
+	std::vector<CompiledNetwork*> plans; // Scratch array holding the plan of each network.
+};
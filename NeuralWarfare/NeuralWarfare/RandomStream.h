@@ -0,0 +1,134 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <random>
+
+// Counter based random numbers: every value is a pure function of the run seed and a position,
+// so any part of a run can be reproduced from the seed alone, independent of thread count or the
+// order work happens to run in.
+//
+// The generator is Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// The run seed is the 64 bit key. The 128 bit counter holds the block position in its first word
+// and the stream coordinates (agent, generation, purpose) in the other three, so each combination
+// of coordinates owns a disjoint stream of 2^34 values that can be opened or seeked in constant time.
+
+/// <summary>
+/// What a stream is used for, keeps streams with the same generation and agent apart
+/// </summary>
+enum class RandomPurpose : uint32_t
+{
+	Spawn,
+	Trainer,
+	Mutation,
+};
+
+/// <summary>
+/// Seekable stream of random numbers, usable with the std distributions
+/// </summary>
+class RandomStream
+{
+public:
+	using result_type = uint32_t;
+
+	/// <summary>
+	/// Opens the stream at position 0
+	/// </summary>
+	/// <param name="seed"> seed of the run</param>
+	/// <param name="generation"> training generation the stream belongs to</param>
+	/// <param name="agent"> agent, team or offspring the stream belongs to</param>
+	/// <param name="purpose"> what the stream is used for</param>
+	RandomStream(uint64_t seed, uint32_t generation, uint32_t agent, RandomPurpose purpose)
+		: key{ static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32) },
+		counter{ 0, agent, generation, static_cast<uint32_t>(purpose) }
+	{
+	}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+	result_type operator()()
+	{
+		if (index == 4)
+		{
+			Refill();
+		}
+		return block[index++];
+	}
+
+	/// <summary>
+	/// Draws 64 bits, used to derive seeds of other streams
+	/// </summary>
+	uint64_t Next64()
+	{
+		uint64_t low = (*this)();
+		return low | static_cast<uint64_t>((*this)()) << 32;
+	}
+
+	/// <summary>
+	/// Moves the stream so the next value drawn is the value at position
+	/// </summary>
+	void Seek(uint64_t position)
+	{
+		counter[0] = static_cast<uint32_t>(position / 4);
+		Refill();
+		index = static_cast<uint32_t>(position % 4);
+	}
+
+	/// <summary>
+	/// Number of values drawn since position 0
+	/// </summary>
+	uint64_t Position() const
+	{
+		// counter[0] already points past the block being read once it is filled
+		return index == 4 && counter[0] == 0 ? 0 : static_cast<uint64_t>(counter[0] - 1) * 4 + index;
+	}
+
+private:
+	uint32_t key[2];
+	uint32_t counter[4];
+	uint32_t block[4] = {};
+	uint32_t index = 4;
+
+	void Refill()
+	{
+		Philox(counter, key, block);
+		counter[0]++;
+		index = 0;
+	}
+
+	static void Philox(const uint32_t in[4], const uint32_t inKey[2], uint32_t out[4])
+	{
+		uint32_t c0 = in[0], c1 = in[1], c2 = in[2], c3 = in[3];
+		uint32_t k0 = inKey[0], k1 = inKey[1];
+		for (int round = 0; round < 10; round++)
+		{
+			const uint64_t product0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+			const uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+			const uint32_t next0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+			const uint32_t next2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+			c1 = static_cast<uint32_t>(product1);
+			c3 = static_cast<uint32_t>(product0);
+			c0 = next0;
+			c2 = next2;
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+		out[0] = c0;
+		out[1] = c1;
+		out[2] = c2;
+		out[3] = c3;
+	}
+};
+
+/// <summary>
+/// Gets the seed of a run, a configured seed of 0 draws a new seed from the system
+/// </summary>
+inline uint64_t ResolveRunSeed(uint64_t configuredSeed)
+{
+	if (configuredSeed != 0)
+	{
+		return configuredSeed;
+	}
+	std::random_device device;
+	return (static_cast<uint64_t>(device()) << 32) | device();
+}
@@ -30,6 +30,7 @@ public:
 	void Draw()
 	{
 		if (network) {
+			network->SyncNodeOutputs();
 			UpdatePosMap();
 			DrawNodesAndSynapses();
 		}
@@ -1,37 +1,67 @@
 #pragma once
 #include "NeuralNetwork.h"
+#include "RandomStream.h"
 #include <random>
 
-template<typename T>
-typename std::list<T>::iterator getRandomElement(typename std::list<T>::iterator start, typename std::list<T>::iterator end, std::mt19937& gen) {
-	if (start == end) {
-		return end;
-	}
-	std::uniform_int_distribution<size_t> distribution(0, std::distance(start, end) - 1);
-	size_t randomIndex = distribution(gen);
-	std::advance(start, randomIndex);
-	return start;
-}
+// Mutations are applied to an indexable view of the network: layers are gathered into an array once per call,
+// nodes are reached through Layer::NodeAt and synapses through NeuralNetwork::GetSynapses.
+// Elements mutated with a per element rate are picked with geometric skips, one draw per mutated element,
+// so the cost of a call follows the number of mutations made rather than the size of the network.
 
-Layer* getRandomLayer(NeuralNetwork::iterator startLayer, NeuralNetwork::iterator endLayer, std::mt19937& gen) {
-	NeuralNetwork::iterator randomLayer = getRandomElement<Layer*>(startLayer, endLayer, gen);
-	return randomLayer != endLayer ? *randomLayer : nullptr;
+size_t getRandomIndex(size_t count, RandomStream& gen) {
+	std::uniform_int_distribution<size_t> distribution(0, count - 1);
+	return distribution(gen);
 }
 
-Node* getRandomNode(NeuralNetwork::iterator startLayer, NeuralNetwork::iterator endLayer, std::mt19937& gen) {
-	Layer* randomLayer = getRandomLayer(startLayer, endLayer, gen);
-	Layer::iterator randomNode = getRandomElement<Node*>(randomLayer->begin(), randomLayer->end(), gen);
-	return randomNode != randomLayer->end() ? *randomNode : nullptr;
+/// <summary>
+/// Calls visit for each index in [0, count) chosen independently with probability rate.
+/// </summary>
+/// <param name="count"> number of elements</param>
+/// <param name="rate"> chance of each element being chosen</param>
+/// <param name="gen"> random stream</param>
+/// <param name="visit"> called with each chosen index in increasing order</param>
+template<typename Visit>
+void forEachSampled(size_t count, double rate, RandomStream& gen, Visit&& visit) {
+	if (count == 0 || rate <= 0) {
+		return;
+	}
+	if (rate >= 1) {
+		for (size_t i = 0; i < count; i++) {
+			visit(i);
+		}
+		return;
+	}
+	// The gap to the next chosen element is the number of failures before a success
+	std::geometric_distribution<size_t> skip(rate);
+	for (size_t i = skip(gen); i < count; i += 1 + skip(gen)) {
+		visit(i);
+	}
 }
 
-Synapse* getRandomSynapse(NeuralNetwork::iterator startLayer, NeuralNetwork::iterator endLayer, std::mt19937& gen) {
-	Node* randomNode = getRandomNode(startLayer, std::prev(endLayer), gen);
-	std::list<Synapse*>::iterator randomSynapse = getRandomElement<Synapse*>(randomNode->outputs.begin(), randomNode->outputs.end(), gen);
-	return randomSynapse != randomNode->outputs.end() ? *randomSynapse : nullptr;
+/// <summary>
+/// Calls visit for each node chosen independently with probability rate, the layers must not change size during the walk.
+/// </summary>
+/// <param name="layers"> layers of the network in order</param>
+/// <param name="visit"> called with the index of the layer and the chosen node</param>
+template<typename Visit>
+void forEachSampledNode(const std::vector<Layer*>& layers, double rate, RandomStream& gen, Visit&& visit) {
+	size_t nodeCount = 0;
+	for (Layer* layer : layers) {
+		nodeCount += layer->size();
+	}
+	size_t layerIndex = 0;
+	size_t layerStart = 0;
+	forEachSampled(nodeCount, rate, gen, [&](size_t i) {
+		while (i >= layerStart + layers[layerIndex]->size()) {
+			layerStart += layers[layerIndex]->size();
+			layerIndex++;
+		}
+		visit(layerIndex, layers[layerIndex]->NodeAt(i - layerStart));
+	});
 }
 
 void SimpleMutate(
-	NeuralNetwork* net, std::mt19937& gen,
+	NeuralNetwork* net, RandomStream& gen,
 	double biasMutationRate,
 	double biasMutationMagnitude,
 	double weightMutationRate,
@@ -46,75 +76,73 @@ void SimpleMutate(
 ) {
 	std::uniform_real_distribution<double> dis(0, 1);
 	if (dis(gen) < layerMutationRate) {
+		std::vector<NeuralNetwork::iterator> layerIters;
+		for (NeuralNetwork::iterator layerIter = net->begin(); layerIter != net->end(); layerIter++) {
+			layerIters.push_back(layerIter);
+		}
 		std::uniform_int_distribution<int> d(0, 1);
 		if (d(gen) == 1) {
+			// Insert in front of a hidden layer, or in front of the output layer when there are none
 			std::uniform_int_distribution<int> sizeDif(-newLayerSizeRange, newLayerSizeRange);
-			NeuralNetwork::iterator randomLayerIter = getRandomElement<Layer*>(std::next(net->begin()), std::prev(net->end()), gen);
-			Layer* newLayer = new Layer(net, randomLayerIter);
-			size_t newLayerSize = newLayerSizeAverage + sizeDif(gen);
-			for (size_t i = 0; i < newLayerSize; i++) {
-				new Node(newLayer, newLayerFunction);
+			size_t nextLayer = layerIters.size() > 2 ? 1 + getRandomIndex(layerIters.size() - 2, gen) : layerIters.size() - 1;
+			int newLayerSize = newLayerSizeAverage + sizeDif(gen);
+			// A layer without nodes could never be connected, so a size of 0 or less adds no layer
+			if (newLayerSize > 0) {
+				Layer* newLayer = new (net) Layer(net, layerIters[nextLayer]);
+				for (int i = 0; i < newLayerSize; i++) {
+					new (net) Node(newLayer, newLayerFunction);
+				}
 			}
 		}
-		else if(net->size() > 2){
-			Layer* randomLayer = getRandomLayer(std::next(net->begin()), std::prev(net->end()), gen);
-			if (randomLayer)
-			{
-				randomLayer->Delete();
-			}
+		else if (layerIters.size() > 2) {
+			(*layerIters[1 + getRandomIndex(layerIters.size() - 2, gen)])->Delete();
 		}
 	}
-	NeuralNetwork::iterator layerIter = net->begin();
-	NeuralNetwork::iterator outputLayerIter = std::prev(net->end());
-	while (layerIter != net->end()) {
-		if (layerIter != net->begin() && layerIter != outputLayerIter && dis(gen) < nodeMutationRate) {
-			std::uniform_int_distribution<int> d(0, 1);
-			if (d(gen) == 1) {
-				if ((*layerIter)->size() > 1) {
-					Layer::iterator delNodeIter = getRandomElement<Node*>((*layerIter)->begin(), (*layerIter)->end(), gen);
-					if (delNodeIter != (*layerIter)->end())
-					{
-						(*delNodeIter)->Delete();
-					}
-				}
-			}
-			else {
-				Layer::iterator functionNodeIter = getRandomElement<Node*>((*layerIter)->begin(), (*layerIter)->end(), gen);
-				new Node(*layerIter, newLayerFunction);
+
+	std::vector<Layer*> layers(net->begin(), net->end());
+
+	// Add or remove a node in hidden layers
+	forEachSampled(layers.size() - 2, nodeMutationRate, gen, [&](size_t i) {
+		Layer* layer = layers[i + 1];
+		std::uniform_int_distribution<int> d(0, 1);
+		if (d(gen) == 1) {
+			if (layer->size() > 1) {
+				layer->NodeAt(getRandomIndex(layer->size(), gen))->Delete();
 			}
 		}
-		Layer::iterator nodeIter = (*layerIter)->begin();
-		while (nodeIter != (*layerIter)->end()) {
-			if (dis(gen) < biasMutationRate) {
-				std::uniform_real_distribution<double> Mag(-biasMutationMagnitude, biasMutationMagnitude);
-				(*nodeIter)->bias += Mag(gen);
-			}
-			if (layerIter != std::prev(net->end()) && dis(gen) < synapseMutationRate) {
-				std::uniform_int_distribution<int> d(0, 1);
-				if (d(gen) == 1) {
-					if ((*nodeIter)->outputs.size() > 0) {
-						std::list<Synapse*>::iterator delSynapseIter = getRandomElement<Synapse*>((*nodeIter)->outputs.begin(), (*nodeIter)->outputs.end(), gen);
-						delete* delSynapseIter;
-					}
-				}
-				else {
-					std::uniform_real_distribution<double> Mag(-newSynapseMagnitude, newSynapseMagnitude);
-					Node* node1 = *nodeIter;
-					NeuralNetwork::iterator outLayer = std::next(layerIter);
-					Node* node2 = getRandomNode(outLayer, net->end(), gen);
-					new Synapse(node1, node2, Mag(gen));
-				}
+		else {
+			new (net) Node(layer, newLayerFunction);
+		}
+	});
+
+	// Add or remove a synapse leaving nodes outside the output layer, new synapses lead to a random node in a later layer
+	forEachSampledNode(layers, synapseMutationRate, gen, [&](size_t layerIndex, Node* node) {
+		if (layerIndex + 1 == layers.size()) {
+			return;
+		}
+		std::uniform_int_distribution<int> d(0, 1);
+		if (d(gen) == 1) {
+			if (!node->outputs.empty()) {
+				delete *std::next(node->outputs.begin(), getRandomIndex(node->outputs.size(), gen));
 			}
-			std::list<Synapse*>::iterator synapseIter = (*nodeIter)->outputs.begin();
-			while (synapseIter != (*nodeIter)->outputs.end()) {
-				if (dis(gen) < weightMutationRate) {
-					std::uniform_real_distribution<double> Mag(-weightMutationMagnitude, weightMutationMagnitude);
-					(*synapseIter)->weight += Mag(gen);
-				}
-				synapseIter++;
+		}
+		else {
+			std::uniform_real_distribution<double> Mag(-newSynapseMagnitude, newSynapseMagnitude);
+			Layer* outLayer = layers[layerIndex + 1 + getRandomIndex(layers.size() - layerIndex - 1, gen)];
+			if (!outLayer->empty()) {
+				new (net) Synapse(node, outLayer->NodeAt(getRandomIndex(outLayer->size(), gen)), Mag(gen));
 			}
-			nodeIter++;
 		}
-		layerIter++;
-	}
+	});
+
+	forEachSampledNode(layers, biasMutationRate, gen, [&](size_t, Node* node) {
+		std::uniform_real_distribution<double> Mag(-biasMutationMagnitude, biasMutationMagnitude);
+		node->SetBias(node->bias + Mag(gen));
+	});
+
+	const std::vector<Synapse*>& synapses = net->GetSynapses();
+	forEachSampled(synapses.size(), weightMutationRate, gen, [&](size_t i) {
+		std::uniform_real_distribution<double> Mag(-weightMutationMagnitude, weightMutationMagnitude);
+		synapses[i]->SetWeight(synapses[i]->weight + Mag(gen));
+	});
 }
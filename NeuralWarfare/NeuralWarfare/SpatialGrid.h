@@ -0,0 +1,301 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "KDTree.h"
+#include "Vec2.h"
+
+/// <summary>
+/// Uniform grid over a bounded area for finding neighbors, an alternative to the KD tree
+/// </summary>
+/// <typeparam name="Obj"> must satisfy the requirements of the Object concept</typeparam>
+/// <remarks>
+/// Build sorts the objects by cell with a counting sort, so a rebuild is O(n) and allocates nothing once
+/// the arrays have grown. The objects of a cell sit next to each other, so walking a neighborhood reads memory in order.
+/// Objects outside the bounds are kept in the nearest border cell. Works best when objects are spread
+/// evenly, a nearest neighbor search walks outwards ring by ring so a far away match costs many empty cells.
+/// </remarks>
+template<Object Obj>
+class SpatialGrid {
+public:
+	using Neighbor = typename KDTree<Obj>::Neighbor; // Same neighbor as the KD tree, so callers can use either index
+	using NeighborSet = typename KDTree<Obj>::NeighborSet; // Same neighbor set as the KD tree, so callers can use either index
+
+	/// <summary>
+	/// Sorts the objects into the grid, replacing the previous contents
+	/// </summary>
+	/// <param name="points"> objects to add, must stay alive while the grid is used</param>
+	/// <param name="min"> lowest corner of the bounds</param>
+	/// <param name="max"> highest corner of the bounds</param>
+	/// <param name="cellSize"> width and height of a cell</param>
+	void Build(const std::vector<Obj*>& points, Vec2 min, Vec2 max, float cellSize);
+
+	/// <summary>
+	/// Finds the nearest Neighbors to a query position, writing them into a caller owned buffer of k neighbors
+	/// </summary>
+	/// <param name="query"> position to find Neighbors to</param>
+	/// <param name="k"> the number of Neighbors to be found, the capacity of the buffer</param>
+	/// <param name="neighbors"> filled with the neighbors, nearest first</param>
+	/// <param name="predicate"> called as predicate(const Obj*), a Neighbor must satisfy it to be returned</param>
+	/// <returns>number of neighbors found, less than k if fewer objects satisfy the predicate</returns>
+	template<typename Predicate>
+	size_t FindNearestNeighbors(const Vec2& query, size_t k, Neighbor* neighbors, const Predicate& predicate) const;
+
+	/// <summary>
+	/// Finds the nearest Neighbors of several kinds in one search, each object is sorted into the set classify picks for it
+	/// </summary>
+	/// <param name="query"> position to find Neighbors to</param>
+	/// <param name="sets"> buffers to fill, start a search with their counts at 0, what they already hold is kept</param>
+	/// <param name="setCount"> the number of sets</param>
+	/// <param name="classify"> called as classify(const Obj*), returns the index of the set an object belongs to or setCount to leave it out</param>
+	template<typename Classify>
+	void FindNearestNeighbors(const Vec2& query, NeighborSet* sets, size_t setCount, const Classify& classify) const;
+
+	/// <summary>
+	/// Finds all objects within range of a query position
+	/// </summary>
+	/// <param name="query"> position to find objects in range of</param>
+	/// <param name="range"> distance to search</param>
+	/// <param name="objects"> objects in range are added to the end</param>
+	/// <param name="predicate"> called as predicate(const Obj*), an object must satisfy it to be returned</param>
+	template<typename Predicate>
+	void FindInRange(const Vec2& query, float range, std::vector<Obj*>& objects, const Predicate& predicate) const;
+
+	/// <summary>
+	/// Calls visit(a, b) once for every pair of objects closer than range, in cell order
+	/// </summary>
+	/// <param name="range"> distance of a pair, no larger than the cell size</param>
+	/// <param name="visit"> called with both objects of a pair, positions are read again for every pair so visit may move objects</param>
+	template<typename Visit>
+	void ForEachPair(float range, Visit visit);
+
+	/// <summary>
+	/// Calls visit(a, b) once for every pair of objects closer than range whose first cell lies in a band of rows, in cell order
+	/// </summary>
+	/// <remarks>
+	/// A pair belongs to the row of its first cell, so bands that split the rows visit every pair once between them,
+	/// and bands can be walked on separate threads as long as visit does not move objects
+	/// </remarks>
+	/// <param name="range"> distance of a pair, no larger than the cell size</param>
+	/// <param name="firstRow"> first row of the band</param>
+	/// <param name="endRow"> one past the last row of the band</param>
+	/// <param name="visit"> called with both objects of a pair</param>
+	template<typename Visit>
+	void ForEachPair(float range, int firstRow, int endRow, Visit visit) const;
+
+	/// <summary>
+	/// Gets the number of rows of cells
+	/// </summary>
+	int Rows() const { return rows; }
+
+	/// <summary>
+	/// Gets the number of cells
+	/// </summary>
+	size_t CellCount() const { return static_cast<size_t>(columns) * rows; }
+
+private:
+	Vec2 min;
+	float cellSize = 1;
+	float inverseCellSize = 1;
+	int columns = 0;
+	int rows = 0;
+	std::vector<size_t> cellStart; // objects of cell c are cellObjects[cellStart[c]] to cellObjects[cellStart[c + 1]]
+	std::vector<Obj*> cellObjects; // objects sorted by cell
+	std::vector<size_t> objectCell; // scratch, cell of each object passed to Build
+
+	int Column(float x) const { return std::clamp(static_cast<int>(std::floor((x - min.x) * inverseCellSize)), 0, columns - 1); }
+	int Row(float y) const { return std::clamp(static_cast<int>(std::floor((y - min.y) * inverseCellSize)), 0, rows - 1); }
+
+	/// <summary>
+	/// Adds the objects of a cell to the buffers of a nearest neighbor search
+	/// </summary>
+	template<typename Classify>
+	void SearchCell(int column, int row, const Vec2& query, NeighborSet* sets, size_t setCount, const Classify& classify) const;
+
+	/// <summary>
+	/// Calls visit for every pair of an object in cell a with an object in cell b, a before b
+	/// </summary>
+	template<typename Visit>
+	void VisitCellPairs(size_t a, size_t b, float rangeSquared, Visit& visit) const;
+};
+
+template<Object Obj>
+void SpatialGrid<Obj>::Build(const std::vector<Obj*>& points, Vec2 min, Vec2 max, float cellSize)
+{
+	SpatialGrid::min = min;
+	SpatialGrid::cellSize = cellSize;
+	inverseCellSize = 1 / cellSize;
+	columns = std::max(1, static_cast<int>(std::ceil((max.x - min.x) * inverseCellSize)));
+	rows = std::max(1, static_cast<int>(std::ceil((max.y - min.y) * inverseCellSize)));
+
+	// Counting sort: count the objects of each cell, turn the counts into start offsets, then place the objects
+	cellStart.assign(CellCount() + 1, 0);
+	objectCell.resize(points.size());
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		size_t cell = static_cast<size_t>(Row(points[i]->pos.y)) * columns + Column(points[i]->pos.x);
+		objectCell[i] = cell;
+		cellStart[cell + 1]++;
+	}
+	for (size_t c = 0; c < CellCount(); c++)
+	{
+		cellStart[c + 1] += cellStart[c];
+	}
+	cellObjects.resize(points.size());
+	// Fill each cell from its start, then move the starts back, which keeps the objects of a cell in their given order
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		cellObjects[cellStart[objectCell[i]]++] = points[i];
+	}
+	for (size_t c = CellCount(); c > 0; c--)
+	{
+		cellStart[c] = cellStart[c - 1];
+	}
+	cellStart[0] = 0;
+}
+
+template<Object Obj>
+template<typename Classify>
+void SpatialGrid<Obj>::SearchCell(int column, int row, const Vec2& query, NeighborSet* sets, size_t setCount, const Classify& classify) const
+{
+	size_t cell = static_cast<size_t>(row) * columns + column;
+	for (size_t i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+	{
+		Obj* object = cellObjects[i];
+		double dx = object->pos.x - query.x;
+		double dy = object->pos.y - query.y;
+		double squaredDist = dx * dx + dy * dy;
+		// Only objects that could make it into one of the buffers are classified
+		if (squaredDist < NeighborSet::Bound(sets, setCount))
+		{
+			size_t set = classify(object);
+			if (set < setCount && sets[set].k > 0)
+			{
+				KDTree<Obj>::InsertNeighbor(sets[set].neighbors, sets[set].count, sets[set].k, squaredDist, object);
+			}
+		}
+	}
+}
+
+template<Object Obj>
+template<typename Classify>
+void SpatialGrid<Obj>::FindNearestNeighbors(const Vec2& query, NeighborSet* sets, size_t setCount, const Classify& classify) const
+{
+	if (cellObjects.empty() || NeighborSet::Bound(sets, setCount) < 0) return;
+
+	const int column = Column(query.x);
+	const int row = Row(query.y);
+	for (int ring = 0; ; ring++)
+	{
+		// Cells on the border of the square ring cells around the query cell
+		const int left = column - ring, right = column + ring, bottom = row - ring, top = row + ring;
+		for (int c = std::max(left, 0); c <= std::min(right, columns - 1); c++)
+		{
+			if (bottom >= 0) SearchCell(c, bottom, query, sets, setCount, classify);
+			if (top < rows && ring > 0) SearchCell(c, top, query, sets, setCount, classify);
+		}
+		for (int r = std::max(bottom + 1, 0); r <= std::min(top - 1, rows - 1); r++)
+		{
+			if (left >= 0 && ring > 0) SearchCell(left, r, query, sets, setCount, classify);
+			if (right < columns && ring > 0) SearchCell(right, r, query, sets, setCount, classify);
+		}
+
+		// Every cell not searched yet lies past one of the sides of the square that still has cells beyond it,
+		// border cells reach out to infinity so a side at the grid border has nothing beyond it
+		bool unsearched = false;
+		double gap = INFINITY;
+		if (left > 0) { unsearched = true; gap = std::min(gap, static_cast<double>(query.x - (min.x + left * cellSize))); }
+		if (right < columns - 1) { unsearched = true; gap = std::min(gap, static_cast<double>(min.x + (right + 1) * cellSize - query.x)); }
+		if (bottom > 0) { unsearched = true; gap = std::min(gap, static_cast<double>(query.y - (min.y + bottom * cellSize))); }
+		if (top < rows - 1) { unsearched = true; gap = std::min(gap, static_cast<double>(min.y + (top + 1) * cellSize - query.y)); }
+		if (!unsearched) break;
+		if (gap > 0 && gap * gap >= NeighborSet::Bound(sets, setCount)) break;
+	}
+}
+
+template<Object Obj>
+template<typename Predicate>
+size_t SpatialGrid<Obj>::FindNearestNeighbors(const Vec2& query, size_t k, Neighbor* neighbors, const Predicate& predicate) const
+{
+	// A search with one set, the objects failing the predicate are left out
+	NeighborSet set{ neighbors, k };
+	FindNearestNeighbors(query, &set, 1, [&predicate](const Obj* object) { return predicate(object) ? size_t(0) : size_t(1); });
+	return set.count;
+}
+
+template<Object Obj>
+template<typename Predicate>
+void SpatialGrid<Obj>::FindInRange(const Vec2& query, float range, std::vector<Obj*>& objects, const Predicate& predicate) const
+{
+	if (cellObjects.empty()) return;
+	const float rangeSquared = range * range;
+	const int lastRow = Row(query.y + range);
+	const int lastColumn = Column(query.x + range);
+	for (int r = Row(query.y - range); r <= lastRow; r++)
+	{
+		for (int c = Column(query.x - range); c <= lastColumn; c++)
+		{
+			size_t cell = static_cast<size_t>(r) * columns + c;
+			for (size_t i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+			{
+				Obj* object = cellObjects[i];
+				float dx = object->pos.x - query.x;
+				float dy = object->pos.y - query.y;
+				if (dx * dx + dy * dy < rangeSquared && predicate(object))
+				{
+					objects.push_back(object);
+				}
+			}
+		}
+	}
+}
+
+template<Object Obj>
+template<typename Visit>
+void SpatialGrid<Obj>::VisitCellPairs(size_t a, size_t b, float rangeSquared, Visit& visit) const
+{
+	for (size_t i = cellStart[a]; i < cellStart[a + 1]; i++)
+	{
+		// Within one cell each pair is visited from its first object only
+		for (size_t j = a == b ? i + 1 : cellStart[b]; j < cellStart[b + 1]; j++)
+		{
+			float dx = cellObjects[i]->pos.x - cellObjects[j]->pos.x;
+			float dy = cellObjects[i]->pos.y - cellObjects[j]->pos.y;
+			if (dx * dx + dy * dy < rangeSquared)
+			{
+				visit(cellObjects[i], cellObjects[j]);
+			}
+		}
+	}
+}
+
+template<Object Obj>
+template<typename Visit>
+void SpatialGrid<Obj>::ForEachPair(float range, Visit visit)
+{
+	ForEachPair(range, 0, rows, visit);
+}
+
+template<Object Obj>
+template<typename Visit>
+void SpatialGrid<Obj>::ForEachPair(float range, int firstRow, int endRow, Visit visit) const
+{
+	const float rangeSquared = range * range;
+	for (int r = firstRow; r < endRow; r++)
+	{
+		for (int c = 0; c < columns; c++)
+		{
+			// A cell pairs with itself and the neighbors after it, so every pair of neighboring cells is visited once
+			size_t cell = static_cast<size_t>(r) * columns + c;
+			VisitCellPairs(cell, cell, rangeSquared, visit);
+			if (c + 1 < columns) VisitCellPairs(cell, cell + 1, rangeSquared, visit);
+			if (r + 1 < rows)
+			{
+				if (c > 0) VisitCellPairs(cell, cell + columns - 1, rangeSquared, visit);
+				VisitCellPairs(cell, cell + columns, rangeSquared, visit);
+				if (c + 1 < columns) VisitCellPairs(cell, cell + columns + 1, rangeSquared, visit);
+			}
+		}
+	}
+}
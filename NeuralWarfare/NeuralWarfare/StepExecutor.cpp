@@ -0,0 +1,83 @@
+#include "StepExecutor.h"
+
+// Weight of the newest step in the moving averages
+static constexpr double averageWeight = 0.05;
+
+// Checks of a counter before sleeping on it, a handoff within a step's time is usually caught while spinning
+static constexpr int spinCount = 256;
+
+StepExecutor::StepExecutor() : worker(&StepExecutor::WorkerLoop, this)
+{
+}
+
+StepExecutor::~StepExecutor()
+{
+	Wait();
+	stopping = true;
+	requested.fetch_add(1, std::memory_order_release);
+	requested.notify_one();
+	worker.join();
+}
+
+void StepExecutor::StartStep(const void* stepBody)
+{
+	body = stepBody;
+	startTime = Clock::now();
+	requested.fetch_add(1, std::memory_order_release);
+	requested.notify_one();
+}
+
+void StepExecutor::Wait()
+{
+	const uint32_t step = requested.load(std::memory_order_relaxed);
+	uint32_t done = completed.load(std::memory_order_acquire);
+	if (done == step)
+	{
+		return;
+	}
+	Clock::time_point waitStart = Clock::now();
+	while (done != step)
+	{
+		done = WaitForChange(completed, done);
+	}
+	Clock::time_point waitEnd = Clock::now();
+
+	metrics.lastHandoff = std::chrono::duration<double, std::micro>(pickupTime - startTime).count();
+	metrics.lastWait = std::chrono::duration<double, std::micro>(waitEnd - waitStart).count();
+	const double weight = metrics.steps == 0 ? 1 : averageWeight;
+	metrics.averageHandoff += (metrics.lastHandoff - metrics.averageHandoff) * weight;
+	metrics.averageWait += (metrics.lastWait - metrics.averageWait) * weight;
+	metrics.steps++;
+}
+
+void StepExecutor::WorkerLoop()
+{
+	uint32_t step = 0;
+	while (true)
+	{
+		step = WaitForChange(requested, step);
+		if (stopping)
+		{
+			return;
+		}
+		pickupTime = Clock::now();
+		run(body);
+		completed.store(step, std::memory_order_release);
+		completed.notify_one();
+	}
+}
+
+uint32_t StepExecutor::WaitForChange(const std::atomic<uint32_t>& counter, uint32_t value)
+{
+	for (int i = 0; i < spinCount; i++)
+	{
+		uint32_t current = counter.load(std::memory_order_acquire);
+		if (current != value)
+		{
+			return current;
+		}
+		std::this_thread::yield();
+	}
+	counter.wait(value, std::memory_order_acquire);
+	return counter.load(std::memory_order_acquire);
+}
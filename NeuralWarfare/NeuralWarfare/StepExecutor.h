@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+/// <summary>
+/// Runs one task per simulation step on a long lived thread, beside the work of the calling thread.
+/// </summary>
+/// <remarks>
+/// Start hands the task over through an atomic step counter and Wait blocks on a second counter
+/// marking the finished step. Both sides spin briefly before sleeping on the counter, so back to back
+/// steps hand over without a system call and no thread is created per step.
+/// </remarks>
+class StepExecutor
+{
+public:
+	/// <summary>
+	/// Time spent handing steps over, in microseconds.
+	/// </summary>
+	struct Metrics
+	{
+		size_t steps = 0; // Steps run since the executor was created.
+		double lastHandoff = 0; // Time from Start until the worker began the last step.
+		double lastWait = 0; // Time the last Wait blocked for.
+		double averageHandoff = 0; // Moving average of the handoff time.
+		double averageWait = 0; // Moving average of the wait time.
+	};
+
+	/// <summary>
+	/// StepExecutor constructor, starts the worker thread
+	/// </summary>
+	StepExecutor();
+
+	/// <summary>
+	/// StepExecutor destructor, waits for a started step and stops the worker thread
+	/// </summary>
+	~StepExecutor();
+
+	StepExecutor(const StepExecutor&) = delete;
+	StepExecutor& operator=(const StepExecutor&) = delete;
+
+	/// <summary>
+	/// Starts a step on the worker thread, the previous step must have been waited on.
+	/// </summary>
+	/// <param name="body">Called with no arguments on the worker thread, must stay alive until Wait returns.</param>
+	template<typename Body>
+	void Start(const Body& body)
+	{
+		run = &RunBody<Body>;
+		StartStep(&body);
+	}
+
+	/// <summary>
+	/// Waits for the started step to finish, returns at once if no step was started.
+	/// </summary>
+	void Wait();
+
+	/// <summary>
+	/// Gets the handoff metrics, only valid on the thread calling Start and Wait.
+	/// </summary>
+	const Metrics& GetMetrics() const { return metrics; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	template<typename Body>
+	static void RunBody(const void* body)
+	{
+		(*static_cast<const Body*>(body))();
+	}
+
+	void (*run)(const void* body) = nullptr;
+	const void* body = nullptr;
+	std::atomic<uint32_t> requested = 0; // Number of steps started.
+	std::atomic<uint32_t> completed = 0; // Number of steps finished.
+	bool stopping = false; // Set before the last request, tells the worker to exit.
+	Clock::time_point startTime; // When the current step was started.
+	Clock::time_point pickupTime; // When the worker began the current step, written by the worker.
+	Metrics metrics;
+	std::thread worker;
+
+	void StartStep(const void* stepBody);
+
+	void WorkerLoop();
+
+	/// <summary>
+	/// Waits until counter no longer holds value, spinning briefly before sleeping.
+	/// </summary>
+	static uint32_t WaitForChange(const std::atomic<uint32_t>& counter, uint32_t value);
+};
@@ -0,0 +1,62 @@
+#include "StepPipeline.h"
+
+StepPipeline::StepPipeline(NeuralWarfareEngine& engine, std::vector<Trainer*>& trainers, size_t depth) : engine(engine), trainers(trainers), depth(depth ? depth : 1)
+{
+}
+
+void StepPipeline::Step(float delta)
+{
+	auto updateTrainers = [this]() { UpdateTrainers(trainers); };
+	for (Trainer* trainer : trainers)
+	{
+		if (trainer->GetActionDelay() != depth - 1)
+		{
+			trainer->SetActionDelay(depth - 1);
+		}
+	}
+
+	if (depth == 1)
+	{
+		for (Trainer* trainer : trainers)
+		{
+			trainer->ObserveEnvironment();
+		}
+		executor.Start(updateTrainers);
+		engine.Update(delta);
+		executor.Wait();
+		for (Trainer* trainer : trainers)
+		{
+			trainer->ExecuteAction();
+		}
+		return;
+	}
+
+	// A trainer without an observation yet skips its first update and picks up the observation taken ahead
+	for (Trainer* trainer : trainers)
+	{
+		trainer->stepAllocations = 0;
+		if (engine.wasReset)
+		{
+			// The observation taken ahead predates the reset, observe again so the trainers see the end of the episode
+			// as they do at depth 1, keeping the rewards of the last step, and drop the actions chosen for the last episode
+			trainer->SetActionDelay(depth - 1);
+			trainer->ObserveAfterReset();
+		}
+	}
+	executor.Start(updateTrainers);
+	engine.Update(delta);
+	for (Trainer* trainer : trainers)
+	{
+		trainer->ExecuteQueuedActions();
+	}
+	for (Trainer* trainer : trainers)
+	{
+		trainer->ObserveAhead();
+	}
+	executor.Wait();
+	for (Trainer* trainer : trainers)
+	{
+		trainer->QueueActions();
+		trainer->SwapObservations();
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include "NeuralWarfareEngine.h"
+#include "StepExecutor.h"
+#include "Trainer.h"
+
+/// <summary>
+/// Runs simulation steps of an engine and the trainers of its teams.
+/// </summary>
+/// <remarks>
+/// At depth 1 a step observes, updates the trainers beside the engine update and then executes the chosen actions,
+/// each step acting on the observation taken at its start.
+/// At depth 2 and above the trainer update of step N also runs beside executing the actions chosen depth - 1 steps
+/// earlier and observing step N + 1 into the trainers' second observation buffer, so the trainers never wait on the
+/// observation. Actions then reach the engine depth - 1 steps later than at depth 1.
+/// </remarks>
+class StepPipeline
+{
+public:
+	/// <summary>
+	/// StepPipeline constructor
+	/// </summary>
+	/// <param name="engine"> engine to step</param>
+	/// <param name="trainers"> trainers of the engine's teams, trainers may be added between steps</param>
+	/// <param name="depth"> pipeline depth, 1 runs the steps one after another</param>
+	StepPipeline(NeuralWarfareEngine& engine, std::vector<Trainer*>& trainers, size_t depth = 1);
+
+	/// <summary>
+	/// Runs one step, the trainers and engine are not touched once this returns
+	/// </summary>
+	/// <param name="delta"> engine update delta</param>
+	void Step(float delta);
+
+	size_t GetDepth() const { return depth; }
+
+	/// <summary>
+	/// Gets the handoff metrics of the thread running the trainer updates
+	/// </summary>
+	const StepExecutor::Metrics& GetMetrics() const { return executor.GetMetrics(); }
+
+private:
+	NeuralWarfareEngine& engine;
+	std::vector<Trainer*>& trainers;
+	size_t depth;
+	StepExecutor executor; // Runs the trainer updates beside the work of the calling thread
+};
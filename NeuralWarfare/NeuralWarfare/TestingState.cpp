@@ -2,8 +2,9 @@
 #include "Application.h"
 #include "TestSelectionState.h"
 #include "TrainingState.h"
-TestingState::TestingState(Application& app) : GameState(app), eng(app.gen, { app.config.engine.sizeX,app.config.engine.sizeY })
+TestingState::TestingState(Application& app) : GameState(app), eng(app.seed, { app.config.engine.sizeX,app.config.engine.sizeY }), stepPipeline(eng, trainers, app.config.engine.pipelineDepth)
 {
+	eng.SetBroadphase(app.config.engine.gridBroadphase ? NeuralWarfareEngine::Broadphase::Grid : NeuralWarfareEngine::Broadphase::Tree);
 
 	functions.push_back(&addfunction);
 	functions.push_back(&sigmoidFunction);
@@ -101,11 +102,6 @@ TestingState::TestingState(Application& app) : GameState(app), eng(app.gen, { ap
 TestingState::~TestingState()
 {
 	delete ui;
-	if (trainerFuture)
-	{
-		trainerFuture->wait();
-		delete trainerFuture;
-	}
 	while (!trainers.empty())
 	{
 		delete trainers.back();
@@ -147,19 +143,7 @@ void TestingState::Update(float deltaTime)
 			eng.Reset();
 			resetTimer = 0;
 		}
-		for (Trainer* trainer : trainers)
-		{
-			trainer->ObserveEnvironment();
-		}
-
-		delete trainerFuture;
-		trainerFuture = new std::future<void>(std::async(std::launch::async, UpdateTrainers, std::ref(trainers)));
-		eng.Update(app.config.engine.updateDelta);
-		trainerFuture->wait();
-		for (Trainer* trainer : trainers)
-		{
-			trainer->ExecuteAction();
-		}
+		stepPipeline.Step(app.config.engine.updateDelta);
 	}
 }
 
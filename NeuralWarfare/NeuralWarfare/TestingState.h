@@ -1,7 +1,7 @@
 #pragma once
 #include "GameState.h"
-#include <future>
 #include "NeuralWarfareTrainers.h"
+#include "StepPipeline.h"
 #include "ActivationFunctions.h"
 
 
@@ -61,11 +61,11 @@ private:
 
 	std::vector<NeuralWarfareEnv*> envs;
 	std::vector<Trainer*> trainers;
+	StepPipeline stepPipeline; // Steps the engine and trainers
 
 	TrainerListEntry* bestTrainerListEntry;
 
 	float resetTimer = 0;
-	std::future<void>* trainerFuture = nullptr;
 	size_t stepsPerFrame = 1;
 
 	/// <summary>
@@ -0,0 +1,149 @@
+#include "ThreadPool.h"
+
+// Pool and queue of the calling thread, set for the workers of a pool
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local size_t currentQueue = 0;
+
+ThreadPool::ThreadPool(size_t workerCount) : queues(new Queue[workerCount + 1])
+{
+	workers.reserve(workerCount);
+	for (size_t i = 0; i < workerCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::Shared()
+{
+	static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+size_t ThreadPool::CurrentQueue() const
+{
+	return currentPool == this ? currentQueue : workers.size();
+}
+
+bool ThreadPool::Push(size_t queue, const Task& task)
+{
+	Queue& q = queues[queue];
+	std::lock_guard<std::mutex> lock(q.mutex);
+	if (q.count == queueCapacity)
+	{
+		return false;
+	}
+	q.tasks[(q.front + q.count) % queueCapacity] = task;
+	q.count++;
+	queuedTasks.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+bool ThreadPool::Take(size_t queue, Task& task)
+{
+	if (queuedTasks.load(std::memory_order_acquire) == 0)
+	{
+		return false;
+	}
+	// Newest task of our own queue first, it is the most likely to still be in cache
+	{
+		Queue& q = queues[queue];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.count)
+		{
+			q.count--;
+			task = q.tasks[(q.front + q.count) % queueCapacity];
+			queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	// Then steal the oldest task of another queue, the oldest tasks tend to be the largest
+	const size_t queueCount = workers.size() + 1;
+	for (size_t i = 1; i < queueCount; i++)
+	{
+		Queue& q = queues[(queue + i) % queueCount];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.count)
+		{
+			task = q.tasks[q.front];
+			q.front = (q.front + 1) % queueCapacity;
+			q.count--;
+			queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::Execute(const Task& task)
+{
+	const size_t allocations = GetThreadAllocationCount();
+	task.run(task.body, task.begin, task.end);
+	// Whichever thread ran the task, its allocations belong to the thread waiting on it
+	const size_t taskAllocations = GetThreadAllocationCount() - allocations;
+	if (taskAllocations)
+	{
+		SetThreadAllocationCount(allocations);
+		task.allocations->fetch_add(taskAllocations, std::memory_order_relaxed);
+	}
+	task.pending->fetch_sub(1, std::memory_order_release);
+}
+
+void ThreadPool::WakeWorkers()
+{
+	// Taking the lock orders the push before a worker's check of queuedTasks, so the wake up cannot be missed
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wake.notify_all();
+}
+
+void ThreadPool::Wait(size_t queue, std::atomic<size_t>& pending)
+{
+	Task task;
+	while (pending.load(std::memory_order_acquire) != 0)
+	{
+		if (Take(queue, task))
+		{
+			Execute(task);
+		}
+		else
+		{
+			// The remaining chunks are running on other threads
+			std::this_thread::yield();
+		}
+	}
+}
+
+void ThreadPool::WorkerLoop(size_t queue)
+{
+	currentPool = this;
+	currentQueue = queue;
+	Task task;
+	while (true)
+	{
+		if (Take(queue, task))
+		{
+			Execute(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this]() { return stopping || queuedTasks.load(std::memory_order_acquire) != 0; });
+		if (stopping)
+		{
+			return;
+		}
+	}
+}
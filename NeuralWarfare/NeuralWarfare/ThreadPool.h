@@ -0,0 +1,178 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "AllocationCounter.h"
+
+/// <summary>
+/// Persistent pool of worker threads sharing work by stealing.
+/// </summary>
+/// <remarks>
+/// Every worker owns a queue of tasks and threads outside the pool share one more queue.
+/// A thread pushes the tasks it creates onto its own queue and takes them back newest first,
+/// idle threads steal the oldest tasks from the other queues. A thread waiting on its tasks runs
+/// queued tasks instead of blocking, so tasks may create and wait on tasks of their own.
+/// Tasks are a function pointer and a pointer to the caller's body with a range, queues have a
+/// fixed capacity and a push to a full queue runs the task in place, so running tasks does no allocation.
+/// Allocations made by tasks are counted for the thread that called ParallelFor, see AllocationCounter.h.
+/// </remarks>
+class ThreadPool
+{
+public:
+	/// <summary>
+	/// ThreadPool constructor
+	/// </summary>
+	/// <param name="workerCount">Number of worker threads, the thread waiting on tasks also runs them.</param>
+	ThreadPool(size_t workerCount);
+
+	/// <summary>
+	/// ThreadPool destructor, waits for the workers to finish their current task
+	/// </summary>
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/// <summary>
+	/// Gets the pool shared by the whole program, with one worker for every hardware thread besides the caller.
+	/// </summary>
+	static ThreadPool& Shared();
+
+	/// <summary>
+	/// Gets the number of threads that run tasks, the workers and the waiting thread.
+	/// </summary>
+	size_t ThreadCount() const { return workers.size() + 1; }
+
+	/// <summary>
+	/// Calls body over [0, count) split into chunks run as tasks, returns once every chunk has run.
+	/// </summary>
+	/// <param name="count">Number of items.</param>
+	/// <param name="grain">Smallest number of items in a chunk.</param>
+	/// <param name="body">Called as body(begin, end) for each chunk, from any thread.</param>
+	template<typename Body>
+	void ParallelFor(size_t count, size_t grain, const Body& body);
+
+private:
+	/// <summary>
+	/// A chunk of a ParallelFor.
+	/// </summary>
+	struct Task
+	{
+		void (*run)(const void* body, size_t begin, size_t end);
+		const void* body;
+		size_t begin;
+		size_t end;
+		std::atomic<size_t>* pending; // Tasks of the ParallelFor that have not finished.
+		std::atomic<size_t>* allocations; // Allocations made by the tasks of the ParallelFor, added to the calling thread's count once they finished.
+	};
+
+	static constexpr size_t queueCapacity = 256;
+
+	/// <summary>
+	/// Ring buffer of tasks, the owner pushes and pops at the back and thieves take from the front.
+	/// </summary>
+	struct alignas(64) Queue
+	{
+		std::mutex mutex;
+		Task tasks[queueCapacity];
+		size_t front = 0;
+		size_t count = 0;
+	};
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<Queue[]> queues; // One queue per worker, then the queue shared by outside threads.
+	std::atomic<size_t> queuedTasks = 0; // Tasks sitting in any queue.
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping = false; // Guarded by sleepMutex.
+
+	template<typename Body>
+	static void RunBody(const void* body, size_t begin, size_t end)
+	{
+		(*static_cast<const Body*>(body))(begin, end);
+	}
+
+	/// <summary>
+	/// Gets the queue of the calling thread.
+	/// </summary>
+	size_t CurrentQueue() const;
+
+	/// <summary>
+	/// Pushes a task onto a queue, returns false if the queue is full.
+	/// </summary>
+	bool Push(size_t queue, const Task& task);
+
+	/// <summary>
+	/// Takes the newest task of a queue, or failing that the oldest task of another queue.
+	/// </summary>
+	bool Take(size_t queue, Task& task);
+
+	/// <summary>
+	/// Runs a task and marks it finished, moving the allocations it made to the task's ParallelFor.
+	/// </summary>
+	static void Execute(const Task& task);
+
+	/// <summary>
+	/// Wakes sleeping workers after tasks were pushed.
+	/// </summary>
+	void WakeWorkers();
+
+	/// <summary>
+	/// Runs queued tasks until pending reaches 0.
+	/// </summary>
+	void Wait(size_t queue, std::atomic<size_t>& pending);
+
+	void WorkerLoop(size_t queue);
+};
+
+template<typename Body>
+void ThreadPool::ParallelFor(size_t count, size_t grain, const Body& body)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	grain = std::max<size_t>(grain, 1);
+	// A few chunks per thread leaves work to steal when chunks take uneven time
+	size_t chunkCount = std::min((count + grain - 1) / grain, ThreadCount() * 4);
+	if (chunkCount <= 1 || workers.empty())
+	{
+		body(0, count);
+		return;
+	}
+
+	const size_t queue = CurrentQueue();
+	std::atomic<size_t> pending = chunkCount - 1;
+	std::atomic<size_t> allocations = 0;
+	const size_t chunkSize = count / chunkCount;
+	const size_t remainder = count % chunkCount;
+	size_t begin = 0;
+	size_t firstEnd = 0;
+	for (size_t c = 0; c < chunkCount; c++)
+	{
+		size_t end = begin + chunkSize + (c < remainder ? 1 : 0);
+		if (c == 0)
+		{
+			// The calling thread runs the first chunk itself
+			firstEnd = end;
+		}
+		else
+		{
+			Task task{ &RunBody<Body>, &body, begin, end, &pending, &allocations };
+			if (!Push(queue, task))
+			{
+				Execute(task);
+			}
+		}
+		begin = end;
+	}
+	WakeWorkers();
+	body(0, firstEnd);
+	Wait(queue, pending);
+	SetThreadAllocationCount(GetThreadAllocationCount() + allocations.load(std::memory_order_relaxed));
+}
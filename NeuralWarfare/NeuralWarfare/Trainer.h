@@ -1,6 +1,10 @@
 #pragma once
 #include <string>
+#include <utility>
+#include <vector>
 #include "Environment.h"
+#include "AllocationCounter.h"
+#include "ThreadPool.h"
 
 /// <summary>
 /// Base class for training agents in an environment.
@@ -11,7 +15,7 @@ public:
 	/// <summary>
 	/// Class representing hyperparameters for the trainer.
 	/// </summary>
-	static class Hyperparameters
+	class Hyperparameters
 	{
 	public:
 		/// <summary>
@@ -49,15 +53,31 @@ public:
 	/// <summary>
 	/// Virtual destructor for Trainer.
 	/// </summary>
-	virtual ~Trainer() {}
+	virtual ~Trainer()
+	{
+		delete LastStepResults;
+		delete aheadStepResults;
+		for (Environment::Action* action : nextActions) { delete action; }
+		for (Environment::Action* action : spareActions) { delete action; }
+		for (Environment::Action* action : executedActions) { delete action; }
+		for (std::list<Environment::Action*>& queued : actionQueue)
+		{
+			for (Environment::Action* action : queued) { delete action; }
+		}
+	}
 
 	/// <summary>
 	/// Observes the environment and updates the last step results.
 	/// </summary>
+	/// <remarks>
+	/// Starts counting the allocations of the step, see stepAllocations.
+	/// </remarks>
 	void ObserveEnvironment()
 	{
-		if (LastStepResults) { delete LastStepResults; }
-		LastStepResults = env->GetResult();
+		size_t allocations = GetThreadAllocationCount();
+		if (!LastStepResults) { LastStepResults = new std::list<Environment::StepResult>(); }
+		env->GetResult(*LastStepResults);
+		stepAllocations = GetThreadAllocationCount() - allocations;
 	}
 
 	/// <summary>
@@ -70,30 +90,164 @@ public:
 	/// </summary>
 	void ExecuteAction()
 	{
-		if (nextActions)
+		size_t allocations = GetThreadAllocationCount();
+		if (!nextActions.empty())
+		{
+			env->TakeAction(nextActions);
+			// Keep the executed actions, and the list nodes holding them, for the next step
+			spareActions.splice(spareActions.end(), nextActions);
+		}
+		stepAllocations += GetThreadAllocationCount() - allocations;
+	}
+
+	// Pipelined steps overlap Update with the next observation and with executing earlier actions.
+	// Observations are double buffered: Update reads LastStepResults while ObserveAhead fills a second buffer,
+	// the two are swapped once Update has finished. Chosen actions wait in a queue for a fixed number of steps,
+	// ExecuteQueuedActions runs the oldest set beside Update and QueueActions adds the new set once Update has finished.
+
+	/// <summary>
+	/// Observes the environment into the second observation buffer, may run beside Update.
+	/// </summary>
+	void ObserveAhead()
+	{
+		size_t allocations = GetThreadAllocationCount();
+		if (!aheadStepResults) { aheadStepResults = new std::list<Environment::StepResult>(); }
+		env->GetResult(*aheadStepResults);
+		pipelineAllocations += GetThreadAllocationCount() - allocations;
+	}
+
+	/// <summary>
+	/// Makes the observation taken by ObserveAhead the one the next Update reads.
+	/// </summary>
+	void SwapObservations()
+	{
+		std::swap(LastStepResults, aheadStepResults);
+	}
+
+	/// <summary>
+	/// Replaces the observation taken ahead with one taken after the environment was reset, may not run beside Update.
+	/// </summary>
+	/// <remarks>
+	/// The replaced observation holds the rewards earned in the last step of the episode, they are kept so they still reach Update.
+	/// </remarks>
+	void ObserveAfterReset()
+	{
+		ObserveAhead();
+		if (LastStepResults && LastStepResults->size() == aheadStepResults->size())
 		{
-			env->TakeAction(*nextActions);
-			while (!nextActions->empty())
+			std::list<Environment::StepResult>::iterator pending = LastStepResults->begin();
+			for (Environment::StepResult& sr : *aheadStepResults)
 			{
-				delete nextActions->front();
-				nextActions->pop_front();
+				sr.reward = (pending++)->reward;
 			}
-			delete nextActions;
-			nextActions = nullptr;
 		}
+		SwapObservations();
+	}
+
+	/// <summary>
+	/// Sets the number of steps chosen actions wait before they are executed by ExecuteQueuedActions, actions already waiting are dropped.
+	/// </summary>
+	void SetActionDelay(size_t delay)
+	{
+		for (std::list<Environment::Action*>& queued : actionQueue)
+		{
+			spareActions.splice(spareActions.end(), queued);
+		}
+		actionQueue.resize(delay);
+		queueHead = 0;
+	}
+
+	/// <summary>
+	/// Gets the number of steps chosen actions wait before they are executed.
+	/// </summary>
+	size_t GetActionDelay() const { return actionQueue.size(); }
+
+	/// <summary>
+	/// Executes the oldest set of queued actions, may run beside Update.
+	/// </summary>
+	void ExecuteQueuedActions()
+	{
+		size_t allocations = GetThreadAllocationCount();
+		std::list<Environment::Action*>& oldest = actionQueue[queueHead];
+		if (!oldest.empty())
+		{
+			env->TakeAction(oldest);
+			// Update may be taking spare actions, so the executed ones are only returned by QueueActions
+			executedActions.splice(executedActions.end(), oldest);
+		}
+		pipelineAllocations += GetThreadAllocationCount() - allocations;
+	}
+
+	/// <summary>
+	/// Queues the actions chosen by the last Update, in the place freed by ExecuteQueuedActions.
+	/// </summary>
+	void QueueActions()
+	{
+		actionQueue[queueHead].splice(actionQueue[queueHead].end(), nextActions);
+		queueHead = (queueHead + 1) % actionQueue.size();
+		spareActions.splice(spareActions.end(), executedActions);
+		stepAllocations += pipelineAllocations;
+		pipelineAllocations = 0;
 	}
 
 	Environment* env; // Pointer to the environment being used for training.
 	bool training = false;
+	ThreadPool* pool = &ThreadPool::Shared(); // Pool the trainer splits its own work over.
+	size_t stepAllocations = 0; // Heap allocations made by the trainer during the last step (observe, update and execute), 0 in steady state outside of evolution.
 protected:
+	/// <summary>
+	/// Starts a new set of next actions, any actions that were not executed are kept for reuse.
+	/// </summary>
+	void BeginActions()
+	{
+		spareActions.splice(spareActions.end(), nextActions);
+	}
+
+	/// <summary>
+	/// Adds an action for a step result to the next actions, recycling an action from an earlier step when one is available.
+	/// </summary>
+	/// <typeparam name="ActionType"> the action type, a trainer must always use the same type</typeparam>
+	/// <param name="sr"> the step result the action responds to</param>
+	/// <returns>The action, reset to a freshly constructed state</returns>
+	template<typename ActionType>
+	ActionType* NewAction(Environment::StepResult& sr)
+	{
+		if (spareActions.empty())
+		{
+			nextActions.push_back(new ActionType(sr));
+			return static_cast<ActionType*>(nextActions.back());
+		}
+		nextActions.splice(nextActions.end(), spareActions, spareActions.begin());
+		ActionType* action = static_cast<ActionType*>(nextActions.back());
+		*action = ActionType(sr);
+		return action;
+	}
+
 	std::list<Environment::StepResult>* LastStepResults = nullptr; // List of the last step results observed from the environment.
-	std::list<Environment::Action*>* nextActions = nullptr; // List of the next actions to be executed in the environment.
+	std::list<Environment::Action*> nextActions; // List of the next actions to be executed in the environment.
+	std::list<Environment::Action*> spareActions; // Executed actions kept for reuse by NewAction.
+
+private:
+	std::list<Environment::StepResult>* aheadStepResults = nullptr; // Observation being taken by ObserveAhead.
+	std::vector<std::list<Environment::Action*>> actionQueue; // Sets of chosen actions waiting to be executed, oldest at queueHead.
+	size_t queueHead = 0; // Slot of the oldest set in actionQueue.
+	std::list<Environment::Action*> executedActions; // Actions executed beside Update, returned to spareActions by QueueActions.
+	size_t pipelineAllocations = 0; // Allocations made beside Update, added to stepAllocations by QueueActions.
 };
 
+/// <summary>
+/// Updates every trainer, each trainer is a task on the shared pool and may split its update into more tasks.
+/// </summary>
 static void UpdateTrainers(std::vector<Trainer*>& trainers)
 {
-	for (Trainer* trainer : trainers)
-	{
-		trainer->Update();
-	}
+	ThreadPool::Shared().ParallelFor(trainers.size(), 1, [&trainers](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				// The pool charges tasks to the thread that started them, so this includes the tasks the update split off and not the tasks of other trainers it ran while waiting
+				size_t allocations = GetThreadAllocationCount();
+				trainers[i]->Update();
+				trainers[i]->stepAllocations += GetThreadAllocationCount() - allocations;
+			}
+		});
 }
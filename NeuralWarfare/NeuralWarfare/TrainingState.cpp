@@ -1,8 +1,10 @@
 #include "TrainingState.h"
 #include "Application.h"
+#include "RandomStream.h"
 
-TrainingState::TrainingState(Application& app) : GameState(app), eng(app.gen, { app.config.engine.sizeX,app.config.engine.sizeY }), engDrawRec({}), netVis(nullptr, {})
+TrainingState::TrainingState(Application& app) : GameState(app), eng(app.seed, { app.config.engine.sizeX,app.config.engine.sizeY }), engDrawRec({}), netVis(nullptr, {}), stepPipeline(eng, trainers, app.config.engine.pipelineDepth)
 {
+	eng.SetBroadphase(app.config.engine.gridBroadphase ? NeuralWarfareEngine::Broadphase::Grid : NeuralWarfareEngine::Broadphase::Tree);
 	netVis.drawRec = {
 	app.config.app.screenWidth * 0.71f,
 	app.config.app.screenHeight * 0.14f,
@@ -157,11 +159,6 @@ TrainingState::TrainingState(Application& app) : GameState(app), eng(app.gen, {
 TrainingState::~TrainingState()
 {
 	delete ui;
-	if (trainerFuture)
-	{
-		trainerFuture->wait();
-		delete trainerFuture;
-	}
 	while (!trainers.empty())
 	{
 		delete trainers.back();
@@ -204,20 +201,7 @@ void TrainingState::Update(float deltaTime)
 			eng.Reset();
 			resetTimer = 0;
 		}
-		for (Trainer* trainer : trainers)
-		{
-			trainer->ObserveEnvironment();
-		}
-
-		delete trainerFuture;
-		trainerFuture = new std::future<void>(std::async(std::launch::async, UpdateTrainers, std::ref(trainers)));
-		eng.Update(app.config.engine.updateDelta);
-		trainerFuture->wait();
-
-		for (Trainer* trainer : trainers)
-		{
-			trainer->ExecuteAction();
-		}
+		stepPipeline.Step(app.config.engine.updateDelta);
 	}
 
 	if (selectedTrainer)
@@ -251,6 +235,13 @@ void TrainingState::Draw()
     DrawRectangleLinesEx(engDrawRec, 5, app.config.ui.secondaryColor);
 	DrawRectangleRec({netVis.drawRec.x - netVis.drawRec.width * 0.5f,netVis.drawRec.y - netVis.drawRec.height * 0.5f ,netVis.drawRec.width,netVis.drawRec.height}, app.config.ui.secondaryColor);
 	netVis.Draw();
+	if (app.config.ui.fpsTextSize > 0)
+	{
+		// Time each step spends handing the trainer updates over and waiting for them, under the FPS counter
+		const StepExecutor::Metrics& metrics = stepPipeline.GetMetrics();
+		std::string overheadString = "Step handoff: " + std::to_string((int)round(metrics.averageHandoff)) + "us wait: " + std::to_string((int)round(metrics.averageWait)) + "us";
+		DrawText(overheadString.c_str(), app.config.app.screenWidth * 0.995 - MeasureText(overheadString.c_str(), app.config.ui.fpsTextSize), app.config.ui.fpsTextSize, app.config.ui.fpsTextSize, app.config.ui.textColor);
+	}
 }
 
 void TrainingState::SetSelectedTrainer(TrainerListEntry* trainerListEntry)
@@ -260,21 +251,21 @@ void TrainingState::SetSelectedTrainer(TrainerListEntry* trainerListEntry)
 
 void TrainingState::AddNewModel()
 {
-	size_t inputSize = NeuralWarfareEnv::MyObservation(eng, nullptr).NNInputSize();
+	size_t inputSize = NeuralWarfareEnv::MyObservation(eng, NeuralWarfareEngine::noAgent).NNInputSize();
 	size_t outputSize = NeuralWarfareEnv::MyAction(0).NNOutputSize();
 	NeuralNetwork* network = new NeuralNetwork(functions);
 	for (size_t i = 0; i < inputSize; i++)
 	{
-		network->AddInput(new Node(nullptr, &addfunction));
+		network->AddInput(new (network) Node(nullptr, &addfunction));
 	}
 	//for (size_t i = 0; i < (inputSize + outputSize) / 2; i++)
 	//{
-	//	new Node(*std::prev(network->end()), &tanhFunction);
+	//	new (network) Node(*std::prev(network->end()), &tanhFunction);
 	//}
-	//new Layer(network);
+	//new (network) Layer(network);
 	for (size_t i = 0; i < outputSize; i++)
 	{
-		network->AddOutput(new Node(nullptr, &sigmoidFunction));
+		network->AddOutput(new (network) Node(nullptr, &sigmoidFunction));
 	}
 	AddTrainer(network,"UnnamedModel");
 }
@@ -299,12 +290,13 @@ void TrainingState::SetLoadPopupHidden(bool hidden)
 void TrainingState::AddTrainer(NeuralNetwork* network,std::string modelName)
 {
 	GeneticAlgorithmNNTrainer::MyHyperparameters hyperperameters("hyperperameters.xml");
-	NeuralWarfareEnv* env = new NeuralWarfareEnv(eng,
-		eng.AddTeam(app.config.engine.teamSize, app.config.engine.agentBaseHealth, { 0,0 }
-		));
+	size_t teamId = eng.AddTeam(app.config.engine.teamSize, app.config.engine.agentBaseHealth, { 0,0 });
+	NeuralWarfareEnv* env = new NeuralWarfareEnv(eng, teamId);
 
 	envs.push_back(env);
-	GeneticAlgorithmNNTrainer* trainer = new GeneticAlgorithmNNTrainer(env, app.gen, hyperperameters, network);
+	// The trainer of each team gets its own key, derived from the run seed and the team
+	uint64_t trainerSeed = RandomStream(app.seed, 0, static_cast<uint32_t>(teamId), RandomPurpose::Trainer).Next64();
+	GeneticAlgorithmNNTrainer* trainer = new GeneticAlgorithmNNTrainer(env, trainerSeed, hyperperameters, network);
 	trainers.push_back(trainer);
 
 	if (envs.size() > 1)
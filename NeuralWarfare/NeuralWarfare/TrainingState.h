@@ -1,7 +1,7 @@
 #pragma once
 #include "GameState.h"
 #include "NeuralWarfareTrainers.h"
-#include <future>
+#include "StepPipeline.h"
 #include "ActivationFunctions.h"
 #include "RaylibNetworkVis.h"
 
@@ -153,7 +153,6 @@ private:
 	NetworkVis netVis;
 
 	float resetTimer = 0;
-	std::future<void>* trainerFuture = nullptr;
 	size_t stepsPerFrame = 1;
 
 	AddFunction addfunction;
@@ -163,6 +162,7 @@ private:
 
 	std::vector<NeuralWarfareEnv*> envs;
 	std::vector<Trainer*> trainers;
+	StepPipeline stepPipeline; // Steps the engine and trainers
 
 	/// <summary>
 	/// Update the Hyperparameter Controls